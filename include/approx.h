@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+// Edit distance between a pattern of at most 64 codes and whole sentences,
+// computed column by column with Myers' bit-parallel algorithm in the
+// global form of Hyyro: one bit per pattern position carries the vertical
+// deltas, so each sentence character costs a handful of word operations.
+struct BitParallelDistance{
+    static const size_t MAX_PATTERN = 64;
+
+    std::vector<uint64_t> peq;
+    size_t m = 0;
+
+    explicit BitParallelDistance(const std::vector<uint16_t>& pattern)
+        : peq(1 << 16, 0), m(pattern.size()){
+        if(m == 0 || m > MAX_PATTERN)
+            throw std::runtime_error("approximate search supports 1 to " + std::to_string(MAX_PATTERN) + " characters");
+        for(size_t i = 0; i < m; ++i)
+            peq[pattern[i]] |= uint64_t(1) << i;
+    }
+
+    // Distance to str[0, n), or any value above k once it is known to
+    // exceed k.
+    int distance(const uint16_t* str, size_t n, int k) const{
+        const uint64_t high = uint64_t(1) << (m - 1);
+        uint64_t pv = ~uint64_t(0), mv = 0;
+        int score = (int)m;
+        for(size_t j = 0; j < n; ++j){
+            uint64_t eq = peq[str[j]];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            if(ph & high)
+                score++;
+            else if(mh & high)
+                score--;
+            if(score - (int)(n - j - 1) > k)
+                return k + 1;
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+        return score;
+    }
+};
@@ -0,0 +1,459 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+#include "matcher.h"
+#include "bitmap.h"
+
+// Partition of codes into classes by their membership across a set of leaf
+// bitmaps. Class 0 is always the class of codes no leaf accepts.
+struct CodeClasses{
+    std::vector<uint16_t> class_of;
+    std::vector<std::vector<uint64_t>> members;
+
+    size_t count() const{
+        return members.size();
+    }
+
+    uint16_t operator()(uint16_t code) const{
+        return code < class_of.size() ? class_of[code] : 0;
+    }
+
+    bool contains(size_t cls, size_t leaf) const{
+        return (members[cls][leaf >> 6] >> (leaf & 63)) & 1;
+    }
+
+    static CodeClasses build(const std::vector<const std::vector<bool>*>& leaves){
+        CodeClasses classes;
+        size_t alphabet = 0;
+        for(auto leaf : leaves)
+            alphabet = std::max(alphabet, leaf->size());
+        size_t words = (leaves.size() + 63) / 64;
+
+        std::map<std::vector<uint64_t>, uint16_t> signatures;
+        signatures[std::vector<uint64_t>(words, 0)] = 0;
+        classes.members.emplace_back(words, 0);
+        classes.class_of.resize(alphabet, 0);
+        for(size_t code = 0; code < alphabet; ++code){
+            std::vector<uint64_t> sig(words, 0);
+            for(size_t j = 0; j < leaves.size(); ++j){
+                if(code < leaves[j]->size() && (*leaves[j])[code])
+                    sig[j >> 6] |= uint64_t(1) << (j & 63);
+            }
+            auto it = signatures.find(sig);
+            if(it == signatures.end()){
+                it = signatures.emplace(sig, (uint16_t)classes.members.size()).first;
+                classes.members.push_back(sig);
+            }
+            classes.class_of[code] = it->second;
+        }
+        return classes;
+    }
+};
+
+// Deterministic automaton for a variable length pattern, with one table
+// column per code class. State 0 is the dead state.
+struct Dfa{
+    static const size_t MAX_STATES = 1 << 16;
+
+    CodeClasses classes;
+    size_t class_count = 0;
+    std::vector<uint32_t> table;
+    std::vector<uint8_t> accepting;
+    uint32_t start = 0;
+
+    template<typename T>
+    static Dfa build(const Matcher<T>& matcher);
+
+    size_t state_count() const{
+        return accepting.size();
+    }
+
+    bool match(const uint16_t* str, size_t len) const{
+        uint32_t state = start;
+        for(size_t i = 0; i < len && state != 0; ++i){
+            state = table[state * class_count + classes(str[i])];
+        }
+        return accepting[state];
+    }
+};
+
+template<typename T>
+struct DfaBuilder{
+    using M = Matcher<T>;
+
+    struct State{
+        int32_t leaf;
+        uint32_t next;
+        std::vector<uint32_t> eps;
+    };
+
+    std::vector<State> nfa;
+    std::vector<const std::vector<bool>*> leaves;
+
+    uint32_t new_state(){
+        nfa.push_back({-1, 0, {}});
+        return (uint32_t)nfa.size() - 1;
+    }
+
+    std::pair<uint32_t, uint32_t> build(const M& m){
+        switch(m.strategy){
+            case M::Single:{
+                auto s = new_state(), a = new_state();
+                nfa[s].leaf = (int32_t)leaves.size();
+                nfa[s].next = a;
+                leaves.push_back(m.cache.get());
+                return {s, a};
+            }
+            case M::Static: case M::Regex: case M::Dynamic:{
+                auto s = new_state(), cur = s;
+                for(auto& sub : m.sub_matcher){
+                    auto [fs, fa] = build(sub);
+                    nfa[cur].eps.push_back(fs);
+                    cur = fa;
+                }
+                return {s, cur};
+            }
+            case M::Or:{
+                auto s = new_state(), a = new_state();
+                for(auto& sub : m.sub_matcher){
+                    auto [fs, fa] = build(sub);
+                    nfa[s].eps.push_back(fs);
+                    nfa[fa].eps.push_back(a);
+                }
+                return {s, a};
+            }
+            case M::Multi:{
+                auto s = new_state(), cur = s;
+                for(size_t i = 0; i < m.repeat_lower_bound; ++i){
+                    auto [fs, fa] = build(m.sub_matcher[0]);
+                    nfa[cur].eps.push_back(fs);
+                    cur = fa;
+                }
+                auto a = new_state();
+                if(m.repeat_upper_bound >= M::INF_LENGTH){
+                    auto [fs, fa] = build(m.sub_matcher[0]);
+                    nfa[cur].eps.push_back(fs);
+                    nfa[fa].eps.push_back(fs);
+                    nfa[fa].eps.push_back(a);
+                }else{
+                    for(size_t i = m.repeat_lower_bound; i < m.repeat_upper_bound; ++i){
+                        auto [fs, fa] = build(m.sub_matcher[0]);
+                        nfa[cur].eps.push_back(a);
+                        nfa[cur].eps.push_back(fs);
+                        cur = fa;
+                    }
+                }
+                nfa[cur].eps.push_back(a);
+                return {s, a};
+            }
+            default:
+                throw std::logic_error("automaton does not support " + m.to_string());
+        }
+    }
+
+    std::vector<uint32_t> closure(std::vector<uint32_t> states) const{
+        std::vector<bool> seen(nfa.size(), false);
+        std::vector<uint32_t> stack = states;
+        for(auto s : states)
+            seen[s] = true;
+        while(!stack.empty()){
+            auto s = stack.back();
+            stack.pop_back();
+            for(auto t : nfa[s].eps){
+                if(!seen[t]){
+                    seen[t] = true;
+                    states.push_back(t);
+                    stack.push_back(t);
+                }
+            }
+        }
+        std::sort(states.begin(), states.end());
+        states.erase(std::unique(states.begin(), states.end()), states.end());
+        return states;
+    }
+
+    Dfa compile(const M& matcher){
+        auto [nfa_start, nfa_accept] = build(matcher);
+        Dfa dfa;
+        dfa.classes = CodeClasses::build(leaves);
+        dfa.class_count = dfa.classes.count();
+
+        std::map<std::vector<uint32_t>, uint32_t> ids;
+        std::vector<std::vector<uint32_t>> sets;
+        auto intern = [&](std::vector<uint32_t> set) -> uint32_t {
+            auto it = ids.find(set);
+            if(it != ids.end())
+                return it->second;
+            if(sets.size() >= Dfa::MAX_STATES)
+                throw std::runtime_error("pattern is too complex to compile");
+            uint32_t id = (uint32_t)sets.size();
+            ids.emplace(set, id);
+            dfa.accepting.push_back(std::binary_search(set.begin(), set.end(), nfa_accept));
+            sets.push_back(std::move(set));
+            return id;
+        };
+
+        intern({});
+        dfa.start = intern(closure({nfa_start}));
+        for(size_t id = 1; id < sets.size(); ++id){
+            dfa.table.resize((id + 1) * dfa.class_count, 0);
+            for(size_t c = 0; c < dfa.class_count; ++c){
+                std::vector<uint32_t> next;
+                for(auto s : sets[id]){
+                    auto leaf = nfa[s].leaf;
+                    if(leaf >= 0 && dfa.classes.contains(c, leaf))
+                        next.push_back(nfa[s].next);
+                }
+                if(next.empty())
+                    continue;
+                auto target = intern(closure(std::move(next)));
+                dfa.table[id * dfa.class_count + c] = target;
+            }
+        }
+        dfa.table.resize(sets.size() * dfa.class_count, 0);
+        return dfa;
+    }
+};
+
+template<typename T>
+Dfa Dfa::build(const Matcher<T>& matcher){
+    DfaBuilder<T> builder;
+    return builder.compile(matcher);
+}
+
+// Bit-parallel simulation of the Glushkov (position) automaton of a
+// variable length pattern, one bit per position and bit 0 for the initial
+// state. Each step is a byte-wise follow table lookup masked by the class
+// of the current code, so no backtracking is needed.
+//
+// Fixed-window subterms the automaton cannot express directly (&, ! and
+// <...>) become blocks: a chain of positions that accept any code, whose
+// exit positions are only kept when the block predicate accepts the window
+// that ends at the current code. Block ids are resolved by the caller.
+struct GlushkovAutomaton{
+    static const size_t MAX_POSITIONS = 64;
+
+    struct Exit{
+        uint32_t block;
+        uint32_t length;
+    };
+
+    CodeClasses classes;
+    std::vector<uint64_t> class_masks;
+    std::vector<uint64_t> follow_table;
+    size_t table_bytes = 0;
+    uint64_t last_mask = 0, exit_mask = 0;
+    std::vector<Exit> exits;
+    bool nullable = false;
+    size_t position_count = 0;
+
+    template<typename T>
+    static GlushkovAutomaton build(const Matcher<T>& matcher, std::vector<const Matcher<T>*>& blocks);
+
+    uint64_t reach(uint64_t state) const{
+        uint64_t res = 0;
+        for(size_t k = 0; k < table_bytes; ++k){
+            res |= follow_table[(k << 8) | ((state >> (k << 3)) & 0xff)];
+        }
+        return res;
+    }
+
+    template<typename BlockEval>
+    bool match(const uint16_t* str, size_t len, const BlockEval& eval) const{
+        if(len == 0)
+            return nullable;
+        uint64_t state = 1;
+        for(size_t i = 0; i < len; ++i){
+            uint64_t r = reach(state);
+            uint64_t next = r & class_masks[classes(str[i])];
+            uint64_t pending = r & exit_mask;
+            while(pending){
+                int p = lowest_bit(pending);
+                pending &= pending - 1;
+                auto& e = exits[p];
+                if(i + 1 >= e.length && eval(e.block, str + i + 1 - e.length, e.length))
+                    next |= uint64_t(1) << p;
+            }
+            state = next;
+            if(!state)
+                return false;
+        }
+        return (state & last_mask) != 0;
+    }
+};
+
+template<typename T>
+struct GlushkovBuilder{
+    using M = Matcher<T>;
+
+    struct Frag{
+        uint64_t first, last;
+        bool nullable;
+    };
+
+    GlushkovAutomaton automaton;
+    std::vector<uint64_t> follow = std::vector<uint64_t>(GlushkovAutomaton::MAX_POSITIONS, 0);
+    std::vector<int32_t> leaf_of = std::vector<int32_t>(GlushkovAutomaton::MAX_POSITIONS, -1);
+    uint64_t any_mask = 0;
+    std::vector<const std::vector<bool>*> leaves;
+    std::map<const std::vector<bool>*, int32_t> leaf_ids;
+    std::vector<const M*>& blocks;
+
+    GlushkovBuilder(std::vector<const M*>& blocks): blocks(blocks){
+        automaton.exits.resize(GlushkovAutomaton::MAX_POSITIONS, {0, 0});
+        automaton.position_count = 1;
+    }
+
+    uint64_t new_position(){
+        if(automaton.position_count >= GlushkovAutomaton::MAX_POSITIONS)
+            throw std::runtime_error("pattern is too complex to compile");
+        return uint64_t(1) << automaton.position_count++;
+    }
+
+    void add_follow(uint64_t from, uint64_t to){
+        while(from){
+            follow[lowest_bit(from)] |= to;
+            from &= from - 1;
+        }
+    }
+
+    Frag concat(const Frag& a, const Frag& b){
+        add_follow(a.last, b.first);
+        return {
+            a.first | (a.nullable ? b.first : 0),
+            b.last | (b.nullable ? a.last : 0),
+            a.nullable && b.nullable
+        };
+    }
+
+    Frag repeat(const M& sub, size_t lower, size_t upper){
+        Frag res{0, 0, true};
+        for(size_t i = 0; i < lower; ++i)
+            res = concat(res, build(sub));
+        if(upper >= M::INF_LENGTH){
+            auto f = build(sub);
+            add_follow(f.last, f.first);
+            f.nullable = true;
+            res = concat(res, f);
+        }else{
+            for(size_t i = lower; i < upper; ++i){
+                auto f = build(sub);
+                f.nullable = true;
+                res = concat(res, f);
+            }
+        }
+        return res;
+    }
+
+    Frag block(const M& m){
+        if(m.length_upper_bound >= M::INF_LENGTH)
+            throw std::logic_error("unbounded subpattern in a variable length sequence is not supported");
+        auto found = std::find(blocks.begin(), blocks.end(), &m);
+        uint32_t id = (uint32_t)(found - blocks.begin());
+        if(found == blocks.end())
+            blocks.push_back(&m);
+
+        size_t lower = std::max<size_t>(m.length_lower_bound, 1), upper = m.length_upper_bound;
+        Frag res{0, 0, false};
+        uint64_t prev = 0;
+        for(size_t j = 1; j <= upper; ++j){
+            uint64_t here = 0, cont = 0;
+            if(j < upper){
+                cont = new_position();
+                any_mask |= cont;
+                here |= cont;
+            }
+            if(j >= lower){
+                auto exit = new_position();
+                automaton.exit_mask |= exit;
+                automaton.exits[lowest_bit(exit)] = {id, (uint32_t)j};
+                res.last |= exit;
+                here |= exit;
+            }
+            if(j == 1)
+                res.first = here;
+            else
+                add_follow(prev, here);
+            prev = cont;
+        }
+        return res;
+    }
+
+    Frag build(const M& m){
+        switch(m.strategy){
+            case M::Single:{
+                auto p = new_position();
+                auto it = leaf_ids.find(m.cache.get());
+                if(it == leaf_ids.end()){
+                    it = leaf_ids.emplace(m.cache.get(), (int32_t)leaves.size()).first;
+                    leaves.push_back(m.cache.get());
+                }
+                leaf_of[lowest_bit(p)] = it->second;
+                return {p, p, false};
+            }
+            case M::Static: case M::Regex: case M::Dynamic:{
+                Frag res{0, 0, true};
+                for(auto& sub : m.sub_matcher)
+                    res = concat(res, build(sub));
+                return res;
+            }
+            case M::Or:{
+                Frag res{0, 0, false};
+                for(auto& sub : m.sub_matcher){
+                    auto f = build(sub);
+                    res.first |= f.first;
+                    res.last |= f.last;
+                    res.nullable |= f.nullable;
+                }
+                return res;
+            }
+            case M::Multi:
+                return repeat(m.sub_matcher[0], m.repeat_lower_bound, m.repeat_upper_bound);
+            case M::And: case M::Not: case M::Bipartite:
+                return block(m);
+        }
+        throw std::logic_error("automaton does not support " + m.to_string());
+    }
+
+    GlushkovAutomaton compile(const M& matcher){
+        auto root = build(matcher);
+        follow[0] = root.first;
+        automaton.last_mask = root.last;
+        automaton.nullable = root.nullable;
+
+        automaton.classes = CodeClasses::build(leaves);
+        automaton.class_masks.assign(automaton.classes.count(), any_mask);
+        for(size_t c = 0; c < automaton.classes.count(); ++c){
+            for(size_t p = 1; p < automaton.position_count; ++p){
+                if(leaf_of[p] >= 0 && automaton.classes.contains(c, leaf_of[p]))
+                    automaton.class_masks[c] |= uint64_t(1) << p;
+            }
+        }
+
+        automaton.table_bytes = (automaton.position_count + 7) / 8;
+        automaton.follow_table.assign(automaton.table_bytes << 8, 0);
+        for(size_t k = 0; k < automaton.table_bytes; ++k){
+            for(size_t v = 0; v < 256; ++v){
+                uint64_t res = 0;
+                for(size_t b = 0; b < 8; ++b){
+                    size_t p = (k << 3) + b;
+                    if(((v >> b) & 1) && p < automaton.position_count)
+                        res |= follow[p];
+                }
+                automaton.follow_table[(k << 8) | v] = res;
+            }
+        }
+        return std::move(automaton);
+    }
+};
+
+template<typename T>
+GlushkovAutomaton GlushkovAutomaton::build(const Matcher<T>& matcher, std::vector<const Matcher<T>*>& blocks){
+    GlushkovBuilder<T> builder(blocks);
+    return builder.compile(matcher);
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+struct SentenceStore;
+
+inline int lowest_bit(uint64_t x){
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return (int)idx;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+inline int popcount64(uint64_t x){
+#ifdef _MSC_VER
+    return (int)__popcnt64(x);
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+// Compressed set of 32 bit ids in the style of a roaring bitmap. Ids are
+// split by their high 16 bits into containers; a container holds a sorted
+// array of low halves while sparse and a 65536 bit bitmap once it has more
+// than ARRAY_LIMIT members.
+class RoaringBitmap{
+public:
+    static const uint32_t ARRAY_LIMIT = 4096;
+    static const uint32_t WORDS = 1024;
+
+    // Ids must be appended in increasing order.
+    void push_back(uint32_t id){
+        uint16_t key = uint16_t(id >> 16), low = uint16_t(id);
+        if(containers_.empty() || containers_.back().key != key)
+            containers_.push_back({key, 0, {}, {}});
+        auto& c = containers_.back();
+        if(c.dense()){
+            c.bits[low >> 6] |= uint64_t(1) << (low & 63);
+        }else{
+            c.array.push_back(low);
+            if(c.array.size() > ARRAY_LIMIT)
+                c.to_bits();
+        }
+        c.cardinality++;
+    }
+
+    bool contains(uint32_t id) const{
+        auto c = find(uint16_t(id >> 16));
+        if(!c)
+            return false;
+        uint16_t low = uint16_t(id);
+        if(c->dense())
+            return (c->bits[low >> 6] >> (low & 63)) & 1;
+        return std::binary_search(c->array.begin(), c->array.end(), low);
+    }
+
+    size_t cardinality() const{
+        size_t total = 0;
+        for(auto& c : containers_)
+            total += c.cardinality;
+        return total;
+    }
+
+    bool empty() const{
+        return containers_.empty();
+    }
+
+    // Calls f(id) for every member in [lo, hi), in increasing order.
+    template<typename F>
+    void for_each_in_range(uint32_t lo, uint32_t hi, F f) const{
+        for(auto& c : containers_){
+            uint32_t base = uint32_t(c.key) << 16;
+            if(base + 0xFFFFu < lo)
+                continue;
+            if(base >= hi)
+                break;
+            if(c.dense()){
+                for(uint32_t w = 0; w < WORDS; ++w){
+                    uint64_t word = c.bits[w];
+                    while(word){
+                        uint32_t id = base + w * 64 + lowest_bit(word);
+                        word &= word - 1;
+                        if(id >= lo && id < hi)
+                            f(id);
+                    }
+                }
+            }else{
+                for(auto low : c.array){
+                    uint32_t id = base + low;
+                    if(id >= lo && id < hi)
+                        f(id);
+                }
+            }
+        }
+    }
+
+    static RoaringBitmap intersect(const RoaringBitmap& a, const RoaringBitmap& b){
+        RoaringBitmap res;
+        size_t i = 0, j = 0;
+        while(i < a.containers_.size() && j < b.containers_.size()){
+            auto& x = a.containers_[i];
+            auto& y = b.containers_[j];
+            if(x.key < y.key){
+                ++i;
+            }else if(y.key < x.key){
+                ++j;
+            }else{
+                Container c = Container::intersect(x, y);
+                if(c.cardinality)
+                    res.containers_.push_back(std::move(c));
+                ++i, ++j;
+            }
+        }
+        return res;
+    }
+
+    static RoaringBitmap unite(const RoaringBitmap& a, const RoaringBitmap& b){
+        RoaringBitmap res;
+        size_t i = 0, j = 0;
+        while(i < a.containers_.size() || j < b.containers_.size()){
+            if(j == b.containers_.size() || (i < a.containers_.size() && a.containers_[i].key < b.containers_[j].key)){
+                res.containers_.push_back(a.containers_[i++]);
+            }else if(i == a.containers_.size() || b.containers_[j].key < a.containers_[i].key){
+                res.containers_.push_back(b.containers_[j++]);
+            }else{
+                res.containers_.push_back(Container::unite(a.containers_[i++], b.containers_[j++]));
+            }
+        }
+        return res;
+    }
+
+    size_t estimate_memory_usage() const{
+        size_t total = sizeof(RoaringBitmap) + containers_.capacity() * sizeof(Container);
+        for(auto& c : containers_)
+            total += c.array.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+        return total;
+    }
+
+private:
+    struct Container{
+        uint16_t key;
+        uint32_t cardinality;
+        std::vector<uint16_t> array;
+        std::vector<uint64_t> bits;
+
+        bool dense() const{
+            return !bits.empty();
+        }
+
+        void to_bits(){
+            bits.assign(WORDS, 0);
+            for(auto low : array)
+                bits[low >> 6] |= uint64_t(1) << (low & 63);
+            array.clear();
+            array.shrink_to_fit();
+        }
+
+        void to_array(){
+            array.clear();
+            array.reserve(cardinality);
+            for(uint32_t w = 0; w < WORDS; ++w){
+                uint64_t word = bits[w];
+                while(word){
+                    array.push_back(uint16_t(w * 64 + lowest_bit(word)));
+                    word &= word - 1;
+                }
+            }
+            bits.clear();
+            bits.shrink_to_fit();
+        }
+
+        static Container intersect(const Container& x, const Container& y){
+            Container c{x.key, 0, {}, {}};
+            if(x.dense() && y.dense()){
+                c.bits.resize(WORDS);
+                for(uint32_t w = 0; w < WORDS; ++w){
+                    c.bits[w] = x.bits[w] & y.bits[w];
+                    c.cardinality += popcount64(c.bits[w]);
+                }
+                if(c.cardinality <= ARRAY_LIMIT)
+                    c.to_array();
+            }else if(x.dense() || y.dense()){
+                auto& sparse = x.dense() ? y : x;
+                auto& dense = x.dense() ? x : y;
+                for(auto low : sparse.array){
+                    if((dense.bits[low >> 6] >> (low & 63)) & 1)
+                        c.array.push_back(low);
+                }
+                c.cardinality = (uint32_t)c.array.size();
+            }else{
+                std::set_intersection(x.array.begin(), x.array.end(), y.array.begin(), y.array.end(), std::back_inserter(c.array));
+                c.cardinality = (uint32_t)c.array.size();
+            }
+            return c;
+        }
+
+        static Container unite(const Container& x, const Container& y){
+            Container c{x.key, 0, {}, {}};
+            if(!x.dense() && !y.dense() && x.cardinality + y.cardinality <= ARRAY_LIMIT){
+                std::set_union(x.array.begin(), x.array.end(), y.array.begin(), y.array.end(), std::back_inserter(c.array));
+                c.cardinality = (uint32_t)c.array.size();
+                return c;
+            }
+            c.bits.assign(WORDS, 0);
+            for(auto* src : {&x, &y}){
+                if(src->dense()){
+                    for(uint32_t w = 0; w < WORDS; ++w)
+                        c.bits[w] |= src->bits[w];
+                }else{
+                    for(auto low : src->array)
+                        c.bits[low >> 6] |= uint64_t(1) << (low & 63);
+                }
+            }
+            for(uint32_t w = 0; w < WORDS; ++w)
+                c.cardinality += popcount64(c.bits[w]);
+            if(c.cardinality <= ARRAY_LIMIT)
+                c.to_array();
+            return c;
+        }
+    };
+
+    const Container* find(uint16_t key) const{
+        auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+            [](const Container& c, uint16_t k){ return c.key < k; });
+        return it != containers_.end() && it->key == key ? &*it : nullptr;
+    }
+
+    std::vector<Container> containers_;
+};
+
+// Per-code bitmaps of the global ids of the sentences containing that code.
+struct CharPostings{
+    std::vector<RoaringBitmap> bitmaps;
+
+    void build(const SentenceStore& store);
+
+    const RoaringBitmap* find(uint16_t code) const{
+        return code < bitmaps.size() ? &bitmaps[code] : nullptr;
+    }
+
+    size_t estimate_memory_usage() const{
+        size_t total = sizeof(CharPostings);
+        for(auto& bitmap : bitmaps)
+            total += bitmap.estimate_memory_usage();
+        return total;
+    }
+};
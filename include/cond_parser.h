@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <cstdint>
@@ -29,7 +30,8 @@ struct cond_token{
     enum TokenType{
         Char, Letters, Number, LBracket, RBracket, LSquare, RSquare, 
         Comma, Quote, Lt, Eq, Gt, At, Hash, Dollar, Asterisk, QuestionMark,
-        And, Or, LParen, RParen
+        And, Or, Not, LParen, RParen, LBrace, RBrace, Slash,
+        Colon, Semicolon, Ge, Le, Percent, Tilde
     };
     size_t nxt_pos;
     std::pair<size_t, size_t> original_pos;
@@ -50,11 +52,13 @@ struct Cond: std::enable_shared_from_this<Cond>{
         Base,
         Comb,
         Option,
+        Not,
         Multi,
         List,
         UnorderedList,
         ListAnd,
-        ListOr
+        ListOr,
+        ListNot
     };
 
     enum class BaseCondType{
@@ -64,11 +68,14 @@ struct Cond: std::enable_shared_from_this<Cond>{
         Frequency,
         Structure,
         Chaizi,
-        Wildcard
+        Wildcard,
+        Tone,
+        Rhyme
     };
 
     CondType type;
-    std::vector<bool> cache;
+    // Shared with every matcher compiled from this condition.
+    std::shared_ptr<std::vector<bool>> cache;
 
     Cond(){}
     virtual ~Cond() = default;
@@ -82,23 +89,29 @@ struct Cond: std::enable_shared_from_this<Cond>{
     }
 
     bool match(uint16_t code) const {
-        if(code >= cache.size())
+        if(!cache || code >= cache->size())
             return false;
-        return cache[code];
+        return (*cache)[code];
     }
 
     virtual void init(){
         auto size = ReString::char_map.size();
-        cache.clear();
-        cache.resize(size, false);
+        cache = std::make_shared<std::vector<bool>>(size, false);
 
         for(auto& [code, data]: ReString::hanzi_data){
-            cache[code] = match(data);
+            (*cache)[code] = match(data);
         }
     }
 
+    // Builds the cache unless it is already built for the current alphabet,
+    // so a condition reused in several places is evaluated once.
+    void prepare(){
+        if(!cache || cache->size() != ReString::char_map.size())
+            init();
+    }
+
     virtual CondMatcher compile(){
-        init();
+        prepare();
         return CondMatcher::create_single_matcher(cache, this->shared_from_this());
     }
 };
@@ -109,7 +122,9 @@ using cond_matcher = Matcher<Cond>;
 struct BaseCond: Cond{
     Cond::BaseCondType baseType = Cond::BaseCondType::Character;
 
-    BaseCond(Cond::BaseCondType type): baseType(type){}
+    BaseCond(Cond::BaseCondType type): baseType(type){
+        this->type = Cond::CondType::Base;
+    }
 };
 
 struct CharCond: BaseCond{
@@ -239,6 +254,78 @@ struct PinyinCond: BaseCond{
     }
 };
 
+// Level (平, tones 1 and 2) or oblique (仄, tones 3 and 4) tone. A
+// polyphonic character matches when any, every, or its first reading has
+// the tone; neutral tones match neither. Atoms with the same tone and
+// policy share one bitmap.
+struct ToneCond: BaseCond{
+    enum Tone{
+        Level,
+        Oblique
+    };
+
+    enum Policy{
+        AnyReading,
+        EveryReading,
+        FirstReading
+    };
+
+    Tone tone;
+    Policy policy;
+
+    ToneCond(Tone tone, Policy policy = AnyReading): BaseCond(Cond::BaseCondType::Tone), tone(tone), policy(policy){}
+
+    std::string toString() const override {
+        static const char* suffix[] = { "", " (every reading)", " (first reading)" };
+        return std::string("Tone=") + (tone == Level ? "ping" : "ze") + suffix[policy];
+    }
+
+    virtual bool match(const HanziData& data) const override {
+        uint8_t mask = tone == Level ? 0x06 : 0x18;
+        if(data.tones == 0)
+            return false;
+        switch(policy){
+            case AnyReading: return (data.tones & mask) != 0;
+            case EveryReading: return (data.tones & ~mask) == 0;
+            case FirstReading: return ((1 << data.first_tone) & mask) != 0;
+        }
+        return false;
+    }
+
+    void init() override {
+        static std::shared_ptr<std::vector<bool>> shared[2][3];
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& bitmap = shared[tone][policy];
+        if(!bitmap || bitmap->size() != ReString::char_map.size()){
+            Cond::init();
+            bitmap = cache;
+        }
+        cache = bitmap;
+    }
+};
+
+// Characters whose first reading has the given final, in either tone class,
+// or when exact, the same final and tone class as a given rhyme group.
+struct RhymeCond: BaseCond{
+    uint16_t group;
+    bool exact;
+
+    RhymeCond(uint16_t group, bool exact): BaseCond(Cond::BaseCondType::Rhyme), group(group), exact(exact){}
+
+    std::string toString() const override {
+        auto result = "Rhyme=" + ReString::rhyme_finals[group >> 1];
+        if(exact)
+            result += (group & 1) ? " (ze)" : " (ping)";
+        return result;
+    }
+
+    virtual bool match(const HanziData& data) const override {
+        auto g = ReString::getRhymeGroup(data.index);
+        return exact ? g == group : g != 0 && (g >> 1) == (group >> 1);
+    }
+};
+
 struct ChaiziCond: BaseCond{
     ReString component;
 
@@ -312,16 +399,15 @@ struct CombCond: Cond{
 
     void init() override {
         for(const auto& c : conds){
-            c->init();
+            c->prepare();
         }
         auto size = ReString::char_map.size();
-        cache.clear();
-        cache.resize(size, true);
+        cache = std::make_shared<std::vector<bool>>(size, true);
 
         for(auto& [code, data]: ReString::hanzi_data){
             for(const auto& c : conds){
                 if(!c->match(code)){
-                    cache[code] = false;
+                    (*cache)[code] = false;
                     break;
                 }
             }
@@ -355,16 +441,15 @@ struct OptionCond: Cond{
 
     void init() override {
         for(const auto& c : conds){
-            c->init();
+            c->prepare();
         }
         auto size = ReString::char_map.size();
-        cache.clear();
-        cache.resize(size, false);
+        cache = std::make_shared<std::vector<bool>>(size, false);
 
         for(auto& [code, data]: ReString::hanzi_data){
             for(const auto& c : conds){
                 if(c->match(code)){
-                    cache[code] = true;
+                    (*cache)[code] = true;
                     break;
                 }
             }
@@ -372,8 +457,38 @@ struct OptionCond: Cond{
     }
 };
 
+// Complement of a single character condition: every mapped code that
+// the inner condition rejects, including codes without hanzi data.
+struct NotCond: Cond{
+    cond_ptr cond;
+
+    NotCond(cond_ptr cond): cond(cond) {
+        type = Cond::CondType::Not;
+    }
+
+    std::string toString() const override {
+        return "Not(" + cond->toString() + ")";
+    }
+
+    virtual bool match(const HanziData& data) const override {
+        return !cond->match(data);
+    }
+
+    void init() override {
+        cond->prepare();
+        auto size = ReString::char_map.size();
+        cache = std::make_shared<std::vector<bool>>(size, false);
+
+        for(size_t code = 0; code < size; ++code){
+            (*cache)[code] = !cond->match(static_cast<uint16_t>(code));
+        }
+    }
+};
+
 struct MultiCond: Cond{
     cond_ptr conds;
+    size_t min_count = 0;
+    size_t max_count = CondMatcher::INF_LENGTH;
 
     MultiCond() {
         type = Cond::CondType::Multi;
@@ -381,8 +496,13 @@ struct MultiCond: Cond{
 
     std::string toString() const override {
         std::string result = "MultiCond:(";
-        result += conds->toString() + ")*";
-        return result;
+        result += conds->toString() + ")";
+        if(min_count == 0 && max_count >= CondMatcher::INF_LENGTH)
+            return result + "*";
+        result += "{" + std::to_string(min_count) + ",";
+        if(max_count < CondMatcher::INF_LENGTH)
+            result += std::to_string(max_count);
+        return result + "}";
     }
 
     virtual bool match(const HanziData& data) const override {
@@ -390,14 +510,13 @@ struct MultiCond: Cond{
     }
 
     void init() override {
-        conds->init();
+        conds->prepare();
     }
 
     CondMatcher compile() override {
-        auto matcher = conds->compile();
         std::vector<CondMatcher> matchers;
-        matchers.push_back(matcher);
-        return CondMatcher::create_multi_matcher(matchers, this->shared_from_this());
+        matchers.push_back(conds->compile());
+        return CondMatcher::create_multi_matcher(std::move(matchers), this->shared_from_this(), min_count, max_count);
     }
 };
 
@@ -423,7 +542,7 @@ struct CondList: Cond{
 
     void init() override {
         for(const auto& c : conds){
-            c->init();
+            c->prepare();
         }
     }
 
@@ -432,7 +551,7 @@ struct CondList: Cond{
         for(const auto& c : conds){
             matchers.push_back(c->compile());
         }
-        return CondMatcher::create_seq_matcher(matchers, this->shared_from_this());
+        return CondMatcher::create_seq_matcher(std::move(matchers), this->shared_from_this());
     }
 };
 
@@ -456,7 +575,7 @@ struct UnorderedCondList: CondList{
 
     void init() override {
         for(const auto& c : conds){
-            c->init();
+            c->prepare();
         }
     }
 
@@ -465,7 +584,7 @@ struct UnorderedCondList: CondList{
         for(const auto& c : conds){
             matchers.push_back(c->compile());
         }
-        return CondMatcher::create_bipartite_matcher(matchers, this->shared_from_this());
+        return CondMatcher::create_bipartite_matcher(std::move(matchers), this->shared_from_this());
     }
 };
 
@@ -494,7 +613,7 @@ struct AndCondList: CondList{
         for(const auto& c : conds){
             matchers.push_back(c->compile());
         }
-        return CondMatcher::create_logic_matcher(matchers, CondMatcher::And, this->shared_from_this());
+        return CondMatcher::create_logic_matcher(std::move(matchers), CondMatcher::And, this->shared_from_this());
     }
 };
 
@@ -523,7 +642,26 @@ struct OrCondList: CondList{
         for(const auto& c : conds){
             matchers.push_back(c->compile());
         }
-        return CondMatcher::create_logic_matcher(matchers, CondMatcher::Or, this->shared_from_this());
+        return CondMatcher::create_logic_matcher(std::move(matchers), CondMatcher::Or, this->shared_from_this());
+    }
+};
+
+// Sentence level negation: matches a window within the bounds of the
+// inner pattern that the inner pattern rejects.
+struct NotCondList: CondList{
+    NotCondList(cond_ptr cond){
+        type = Cond::CondType::ListNot;
+        conds.push_back(cond);
+    }
+
+    std::string toString() const override {
+        return "Not: [ " + conds[0]->toString() + " ]";
+    }
+
+    CondMatcher compile() override {
+        std::vector<CondMatcher> matchers;
+        matchers.push_back(conds[0]->compile());
+        return CondMatcher::create_not_matcher(std::move(matchers));
     }
 };
 
@@ -532,4 +670,7 @@ std::shared_ptr<BaseCond> parseBaseCond(const std::vector<cond_token>& tokens, s
 std::shared_ptr<CombCond> parseCombCond(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end);
 std::shared_ptr<OptionCond> parseOptionCond(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end);
 std::shared_ptr<CondList> parseCondList(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end);
+bool parseTonePattern(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end, CondList& condList);
+cond_ptr parseCondListItem(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end);
+std::shared_ptr<MultiCond> parseRepetition(const std::vector<cond_token>& tokens, size_t pos, size_t pos_end);
 std::shared_ptr<CondList> parseGlobalExpression(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end);
@@ -6,6 +6,7 @@
 
 #include "restring.h"
 #include "cond_parser.h"
+#include "bitmap.h"
 
 struct PoetryItem {
     std::string dynasty;
@@ -15,21 +16,68 @@ struct PoetryItem {
     std::string title;
     ReString content;
     std::vector<ReString> sentences;
+    // Optional fifth CSV column, 0 when absent.
+    double popularity = 0;
 
     PoetryItem(){}
 
     size_t estimateMemoryUsage() const;
 };
 
+// Sentences of one length, stored back to back in a single code arena in
+// poem order, with back-pointers to the poem and line they came from.
+struct SentenceBucket {
+    size_t length = 0;
+    size_t first_id = 0;
+    std::vector<uint16_t> codes;
+    std::vector<uint32_t> poetry_ids;
+    std::vector<uint32_t> line_ids;
+
+    size_t size() const {
+        return poetry_ids.size();
+    }
+
+    const uint16_t* sentence(size_t i) const {
+        return codes.data() + i * length;
+    }
+};
+
+// All sentences of the corpus grouped by length, indexed by length. Global
+// sentence ids run through the buckets in order of increasing length.
+struct SentenceStore {
+    std::vector<SentenceBucket> buckets;
+    size_t sentence_count = 0;
+    size_t poem_count = 0;
+    // Lines before each poem in corpus order, poem_count + 1 entries.
+    std::vector<size_t> poem_first_line;
+
+    void build(const std::vector<PoetryItem>& items);
+
+    size_t maxLength() const {
+        return buckets.empty() ? 0 : buckets.size() - 1;
+    }
+
+    // Bucket holding the sentence with global id `id`.
+    const SentenceBucket& bucketOf(size_t id) const;
+
+    size_t estimateMemoryUsage() const;
+};
+
 class PoetryDatabase {
 private:
     std::vector<PoetryItem> poetry_items_;
+    SentenceStore sentence_store_;
+    CharPostings char_postings_;
 
 public:
     int loadFromCSV(const std::string& filename);
     
     const std::vector<PoetryItem>& getAllPoetry() const;
 
+    const SentenceStore& getSentenceStore() const;
+
+    const CharPostings& getCharPostings() const;
+
     size_t estimateMemoryUsage() const;
 
     PoetryItem getPoetryById(size_t id) const;
@@ -41,7 +89,8 @@ private:
                      std::string& title, 
                      std::string& dynasty, 
                      std::string& author, 
-                     std::string& content);
+                     std::string& content,
+                     double& popularity);
     
     std::string trimQuotes(const std::string& str);
 
@@ -50,9 +99,11 @@ private:
     void insertItem(std::string& title, 
                     std::string& dynasty, 
                     std::string& author, 
-                    std::string& content){
+                    std::string& content,
+                    double popularity){
         auto id = poetry_items_.size();
         PoetryItem item;
+        item.popularity = popularity;
         item.id = id;
         item.title = title;
         item.dynasty = dynasty;
@@ -1,11 +1,27 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 #include "cond_parser.h"
 #include "database.h"
+#include "program.h"
+#include "index.h"
+#include "kernel.h"
+#include "query.h"
+#include "approx.h"
+#include "parallel.h"
 
 struct QueryResult{
     size_t poetry_id;
     std::vector<size_t> match_positions;
+    // Ranking key of ranked queries, lower first; 0 otherwise.
+    double score = 0;
 };
 
 enum class ExecuteStrategy{
@@ -13,43 +29,774 @@ enum class ExecuteStrategy{
     Parallel,
 };
 
+struct ExecuteStats{
+    size_t scanned = 0;
+    size_t pruned = 0;
+    BusyTime busy;
+    // Set when a cancel token stopped the scan before it covered the corpus.
+    bool truncated = false;
+};
+
+// Whether work should stop before the next chunk, noting it in `truncated`.
+inline bool stop_requested(const CancelToken* cancel, std::atomic<bool>& truncated){
+    if(!cancel || !cancel->stopped())
+        return false;
+    truncated = true;
+    return true;
+}
+
+struct SentenceHit{
+    uint32_t poetry_id;
+    uint32_t line_id;
+
+    bool operator<(const SentenceHit& other) const{
+        return poetry_id != other.poetry_id ? poetry_id < other.poetry_id : line_id < other.line_id;
+    }
+};
+
+// Length buckets a program can match, clamped to the lengths present.
+inline std::pair<size_t, size_t> bucket_range(const MatchProgram& program, const SentenceStore& store){
+    size_t lo = std::max<size_t>(program.length_lower_bound, 1);
+    size_t hi = std::min(program.length_upper_bound, store.maxLength());
+    return {lo, hi};
+}
+
+// Global ids of the sentences holding every code set the program requires:
+// the union of the code bitmaps within a set, intersected across sets from
+// the smallest up. Returns false when the program requires nothing.
+inline bool candidate_filter(const MatchProgram& program, const CharPostings& postings, RoaringBitmap& filter){
+    if(program.required.empty())
+        return false;
+    std::vector<RoaringBitmap> sets;
+    for(auto& codes : program.required){
+        RoaringBitmap set;
+        for(auto code : codes){
+            if(auto bitmap = postings.find(code))
+                set = RoaringBitmap::unite(set, *bitmap);
+        }
+        sets.push_back(std::move(set));
+    }
+    std::sort(sets.begin(), sets.end(), [](const RoaringBitmap& a, const RoaringBitmap& b){
+        return a.cardinality() < b.cardinality();
+    });
+    filter = std::move(sets[0]);
+    for(size_t i = 1; i < sets.size() && !filter.empty(); ++i)
+        filter = RoaringBitmap::intersect(filter, sets[i]);
+    return true;
+}
+
+// Sentences of a bucket the program has to run on. Without a usable index
+// or filter this is the whole bucket and `ids` is left empty.
+inline bool bucket_candidates(const MatchProgram& program, const PositionalIndex* index, const RoaringBitmap* filter, const SentenceBucket& bucket, std::vector<uint32_t>& ids, ExecuteStats& stats){
+    bool pruned = index && index->candidates(bucket.length, program.anchors, ids);
+    if(filter){
+        auto first = (uint32_t)bucket.first_id;
+        if(pruned){
+            ids.erase(std::remove_if(ids.begin(), ids.end(), [&](uint32_t i){ return !filter->contains(first + i); }), ids.end());
+        }else{
+            ids.clear();
+            filter->for_each_in_range(first, first + (uint32_t)bucket.size(), [&](uint32_t id){ ids.push_back(id - first); });
+            pruned = true;
+        }
+    }
+    size_t scanned = pruned ? ids.size() : bucket.size();
+    stats.scanned += scanned;
+    stats.pruned += bucket.size() - scanned;
+    return pruned;
+}
+
+inline std::vector<QueryResult> group_sorted_hits(const std::vector<SentenceHit>& hits){
+    std::vector<QueryResult> results;
+    for(auto& hit : hits){
+        if(results.empty() || results.back().poetry_id != hit.poetry_id)
+            results.push_back({hit.poetry_id, {}});
+        results.back().match_positions.push_back(hit.line_id);
+    }
+    return results;
+}
+
+inline std::vector<QueryResult> group_hits(std::vector<SentenceHit>& hits){
+    std::sort(hits.begin(), hits.end());
+    return group_sorted_hits(hits);
+}
+
+// A page of results in poem order: from poem id `start` on, skip `offset`
+// poems and keep at most `limit` of them, or all when 0. After execution
+// `next` is the start of the following page and `more` tells whether it
+// has results.
+struct Page{
+    size_t start = 0;
+    size_t offset = 0;
+    size_t limit = 0;
+    size_t next = 0;
+    // Part of offset not yet skipped when a truncated scan stopped, to
+    // pass again with next.
+    size_t skip = 0;
+    bool more = false;
+
+    bool bounded() const{
+        return start > 0 || limit > 0;
+    }
+
+    // Results a scan in poem order needs before it may stop, 0 for all. The
+    // one past the page tells whether another page follows.
+    size_t needed() const{
+        return limit ? offset + limit + 1 : 0;
+    }
+
+    // `end` is where the scan stopped; before the corpus ends when it was
+    // truncated, so the next page resumes from there.
+    void apply(std::vector<QueryResult>& results, size_t end, bool truncated = false){
+        bool full = limit && results.size() > offset + limit;
+        more = full || truncated;
+        skip = more && !full ? offset - std::min(offset, results.size()) : 0;
+        if(full)
+            results.resize(offset + limit);
+        results.erase(results.begin(), results.begin() + std::min(offset, results.size()));
+        next = full ? results.back().poetry_id + 1 : end;
+    }
+};
+
+// Poem ids splitting poems [start, end) into chunks of about `lines`
+// lines each, so a chunk of long poems costs about as much as one of
+// quatrains.
+inline std::vector<size_t> line_chunks(const SentenceStore& store, size_t start, size_t end, size_t lines){
+    std::vector<size_t> bounds{start};
+    auto& first_line = store.poem_first_line;
+    while(bounds.back() < end){
+        size_t from = bounds.back();
+        auto it = std::upper_bound(first_line.begin() + from + 1, first_line.begin() + end + 1, first_line[from] + lines);
+        bounds.push_back(std::max<size_t>(from + 1, it - first_line.begin() - 1));
+    }
+    return bounds;
+}
+
+// Scans poems [start, end) in chunks of similar line counts that the
+// threads claim in increasing order; scan(first, last, out) appends the
+// results of poems [first, last) in poem order and returns the work it
+// did. Once finished chunks hold `needed` results no further chunk is
+// claimed. The chunks scanned always form a prefix, so their results are
+// the first ones in poem order. When `cancel` stops, the prefix ends at
+// the first chunk claimed afterwards and `end` is lowered to match; the
+// first chunk is always scanned, so resuming from `end` makes progress.
+template<typename F>
+std::vector<QueryResult> scan_ordered(const SentenceStore& store, size_t start, size_t& end, size_t needed, const CancelToken* cancel, ExecuteStats& stats, F scan){
+    const size_t SCAN_LINES = 2048;
+    auto bounds = line_chunks(store, start, end, SCAN_LINES);
+    size_t chunks = bounds.size() - 1;
+    std::vector<std::vector<QueryResult>> slots(chunks);
+    std::atomic<size_t> next{0}, found{0}, stop{chunks}, cut{chunks}, work{0};
+    std::atomic<bool> truncated{false};
+    auto lower = [](std::atomic<size_t>& bound, size_t value){
+        size_t current = bound.load();
+        while(value < current && !bound.compare_exchange_weak(current, value));
+    };
+    stats.busy.prepare();
+
+    // A chunk is only claimed below `stop` and every claimed chunk is
+    // scanned unless cancelled, so the claimed chunks stay a prefix.
+    auto claim = [&](size_t& c){
+        c = next.load();
+        while(c < stop.load()){
+            if(next.compare_exchange_weak(c, c + 1))
+                return true;
+        }
+        return false;
+    };
+    parallel_run([&](size_t slot){
+        size_t c;
+        while(claim(c)){
+            if(c > 0 && stop_requested(cancel, truncated)){
+                lower(cut, c);
+                lower(stop, c);
+                break;
+            }
+            stats.busy.run(slot, [&]{
+                work += scan(bounds[c], bounds[c + 1], slots[c]);
+            });
+            if(needed && found.fetch_add(slots[c].size()) + slots[c].size() >= needed)
+                lower(stop, c + 1);
+        }
+    });
+
+    // Chunks from the cut on are dropped to keep the prefix, including any
+    // finished after it; a page the prefix still fills is not truncated.
+    stats.scanned += work;
+    if(cut < chunks){
+        slots.resize(cut);
+        size_t kept = 0;
+        for(auto& slot : slots)
+            kept += slot.size();
+        if(!needed || kept < needed){
+            stats.truncated = true;
+            end = bounds[cut];
+        }
+    }
+    std::vector<QueryResult> results;
+    for(auto& slot : slots)
+        std::move(slot.begin(), slot.end(), std::back_inserter(results));
+    return results;
+}
+
 template<ExecuteStrategy strategy>
 struct Executor{
-    std::vector<QueryResult> execute(cond_matcher& matcher, const std::vector<PoetryItem>& items){
-        static_assert(false, "Invalid execute strategy");
-    }
+    static_assert(strategy != strategy, "Invalid execute strategy");
 };
 
 template<>
 struct Executor<ExecuteStrategy::Sequential>{
-    std::vector<QueryResult> execute(cond_matcher& matcher, const std::vector<PoetryItem>& items){
-        std::vector<QueryResult> results;
-        for(auto& item : items){
-            auto res = matcher.batch_match(item.sentences);
-            if(!res.empty()){
-                results.push_back({item.id, res});
-            }
+    ExecuteStats stats;
+    bool use_kernels = true;
+
+    std::vector<QueryResult> execute(const MatchProgram& program, const SentenceStore& store, const CharPostings* postings = nullptr, const PositionalIndex* index = nullptr){
+        std::vector<SentenceHit> hits;
+        std::vector<uint32_t> ids;
+        RoaringBitmap filter;
+        bool filtered = postings && candidate_filter(program, *postings, filter);
+        auto range = bucket_range(program, store);
+        for(size_t len = range.first; len <= range.second; ++len){
+            auto& bucket = store.buckets[len];
+            bool pruned = bucket_candidates(program, index, filtered ? &filter : nullptr, bucket, ids, stats);
+            size_t count = pruned ? ids.size() : bucket.size();
+            scan_bucket(program, bucket, pruned ? ids.data() : nullptr, 0, count, use_kernels, [&](size_t i){
+                hits.push_back({bucket.poetry_ids[i], bucket.line_ids[i]});
+            });
         }
-        return results;
+        return group_hits(hits);
     }
 };
 
 template<>
 struct Executor<ExecuteStrategy::Parallel>{
-    std::vector<QueryResult> execute(cond_matcher& matcher, const std::vector<PoetryItem>& items){
-        std::vector<QueryResult> results;
-        
-        #pragma omp parallel for
-        for(int i = 0; i < items.size(); ++i){
-            auto& item = items[i];
-            auto res = matcher.batch_match(item.sentences);
-            if(!res.empty()){
-                #pragma omp critical
-                {
-                    results.push_back({item.id, res});
+    static const int SCAN_BLOCK = 1024;
+
+    ExecuteStats stats;
+    bool use_kernels = true;
+    Page page;
+    const CancelToken* cancel = nullptr;
+
+    std::vector<QueryResult> execute(const MatchProgram& program, const SentenceStore& store, const CharPostings* postings = nullptr, const PositionalIndex* index = nullptr){
+        // A scan that may be cancelled runs in poem order too, so what it
+        // found before stopping is a prefix the cursor can resume from.
+        if(page.bounded() || cancel)
+            return execute_page(program, store, postings, index);
+        RoaringBitmap filter;
+        bool filtered = postings && candidate_filter(program, *postings, filter);
+        auto range = bucket_range(program, store);
+
+        struct Block{
+            size_t len, begin, end;
+        };
+        std::vector<Block> blocks;
+        std::vector<std::vector<uint32_t>> candidates(range.second + 1);
+        std::vector<char> pruned(range.second + 1, 0);
+        for(size_t len = range.first; len <= range.second; ++len){
+            pruned[len] = bucket_candidates(program, index, filtered ? &filter : nullptr, store.buckets[len], candidates[len], stats);
+            size_t count = pruned[len] ? candidates[len].size() : store.buckets[len].size();
+            for(size_t begin = 0; begin < count; begin += SCAN_BLOCK)
+                blocks.push_back({len, begin, std::min(count, begin + SCAN_BLOCK)});
+        }
+
+        // Blocks run in bucket order and each bucket is in poem order, so
+        // the hits form one ascending run per length.
+        auto hits = collect_ordered<SentenceHit>((int)blocks.size(), stats.busy, [&](int b, std::vector<SentenceHit>& buffer){
+            auto& block = blocks[b];
+            auto& bucket = store.buckets[block.len];
+            scan_bucket(program, bucket, pruned[block.len] ? candidates[block.len].data() : nullptr, block.begin, block.end, use_kernels, [&](size_t i){
+                buffer.push_back({bucket.poetry_ids[i], bucket.line_ids[i]});
+            });
+        });
+        merge_runs(hits, std::less<SentenceHit>());
+        auto results = group_sorted_hits(hits);
+        page.apply(results, store.poem_count);
+        return results;
+    }
+
+    // Scans poem ranges in order and stops once the page is filled, so a
+    // first page of a common pattern touches a small part of the corpus.
+    std::vector<QueryResult> execute_page(const MatchProgram& program, const SentenceStore& store, const CharPostings* postings, const PositionalIndex* index){
+        RoaringBitmap filter;
+        bool filtered = postings && candidate_filter(program, *postings, filter);
+        auto range = bucket_range(program, store);
+
+        ExecuteStats candidate_stats;
+        std::vector<std::vector<uint32_t>> candidates(range.second + 1);
+        std::vector<char> pruned(range.second + 1, 0);
+        for(size_t len = range.first; len <= range.second; ++len)
+            pruned[len] = bucket_candidates(program, index, filtered ? &filter : nullptr, store.buckets[len], candidates[len], candidate_stats);
+        stats.pruned += candidate_stats.pruned;
+
+        size_t end = store.poem_count;
+        auto results = scan_ordered(store, page.start, end, page.needed(), cancel, stats, [&](size_t first, size_t last, std::vector<QueryResult>& out){
+            std::vector<SentenceHit> hits;
+            size_t tested = 0;
+            for(size_t len = range.first; len <= range.second; ++len){
+                auto& bucket = store.buckets[len];
+                auto& ids = candidates[len];
+                size_t lo = std::lower_bound(bucket.poetry_ids.begin(), bucket.poetry_ids.end(), (uint32_t)first) - bucket.poetry_ids.begin();
+                size_t hi = std::lower_bound(bucket.poetry_ids.begin() + lo, bucket.poetry_ids.end(), (uint32_t)last) - bucket.poetry_ids.begin();
+                if(pruned[len]){
+                    lo = std::lower_bound(ids.begin(), ids.end(), (uint32_t)lo) - ids.begin();
+                    hi = std::lower_bound(ids.begin() + lo, ids.end(), (uint32_t)hi) - ids.begin();
+                }
+                tested += hi - lo;
+                scan_bucket(program, bucket, pruned[len] ? ids.data() : nullptr, lo, hi, use_kernels, [&](size_t i){
+                    hits.push_back({bucket.poetry_ids[i], bucket.line_ids[i]});
+                });
+            }
+            out = group_hits(hits);
+            return tested;
+        });
+        page.apply(results, end, stats.truncated);
+        return results;
+    }
+};
+
+// Runs many single-line programs in one pass over the corpus. Every block
+// of a bucket is tested by all programs whose length bounds admit the
+// bucket while it is still in cache; buckets no program admits are never
+// read. Programs whose required characters leave few candidates are run
+// on their own through the postings instead, as a full pass would cost
+// them more than it shares.
+struct BatchExecutor{
+    static const int SCAN_BLOCK = 1024;
+    static const size_t SELECTIVE_RATIO = 8;
+
+    std::vector<ExecuteStats> stats;
+    BusyTime busy;
+    bool use_kernels = true;
+    const CancelToken* cancel = nullptr;
+
+    std::vector<std::vector<QueryResult>> execute(const std::vector<MatchProgram>& programs, const SentenceStore& store, const CharPostings* postings = nullptr, const PositionalIndex* index = nullptr){
+        stats.assign(programs.size(), {});
+        std::vector<std::vector<QueryResult>> results(programs.size());
+        std::vector<std::vector<uint32_t>> by_length(store.maxLength() + 1);
+        std::vector<char> shared(programs.size(), 0);
+        for(size_t q = 0; q < programs.size(); ++q){
+            auto range = bucket_range(programs[q], store);
+            size_t count = 0;
+            for(size_t len = range.first; len <= range.second; ++len)
+                count += store.buckets[len].size();
+            RoaringBitmap filter;
+            if(postings && candidate_filter(programs[q], *postings, filter) && filter.cardinality() * SELECTIVE_RATIO < count){
+                Executor<ExecuteStrategy::Parallel> single;
+                single.use_kernels = use_kernels;
+                single.cancel = cancel;
+                results[q] = single.execute(programs[q], store, postings, index);
+                stats[q] = single.stats;
+                continue;
+            }
+            for(size_t len = range.first; len <= range.second; ++len)
+                by_length[len].push_back((uint32_t)q);
+            shared[q] = 1;
+            stats[q].scanned = count;
+            stats[q].pruned = store.sentence_count - count;
+        }
+
+        struct Block{
+            size_t len, begin, end;
+        };
+        std::vector<Block> blocks;
+        for(size_t len = 1; len < by_length.size(); ++len){
+            if(by_length[len].empty())
+                continue;
+            for(size_t begin = 0; begin < store.buckets[len].size(); begin += SCAN_BLOCK)
+                blocks.push_back({len, begin, std::min(store.buckets[len].size(), begin + SCAN_BLOCK)});
+        }
+
+        // Each block keeps the hits of its programs apart, in the order of
+        // by_length; blocks run in bucket order and each bucket is in poem
+        // order, so every program's hits form one ascending run per length.
+        std::vector<std::vector<std::vector<SentenceHit>>> found(blocks.size());
+        std::atomic<bool> truncated{false};
+        busy.prepare();
+        parallel_for(blocks.size(), [&](size_t b, size_t slot){
+            if(stop_requested(cancel, truncated))
+                return;
+            busy.run(slot, [&]{
+                auto& block = blocks[b];
+                auto& bucket = store.buckets[block.len];
+                auto& queries = by_length[block.len];
+                found[b].resize(queries.size());
+                for(size_t k = 0; k < queries.size(); ++k){
+                    scan_bucket(programs[queries[k]], bucket, nullptr, block.begin, block.end, use_kernels, [&](size_t i){
+                        found[b][k].push_back({bucket.poetry_ids[i], bucket.line_ids[i]});
+                    });
+                }
+            });
+        });
+
+        std::vector<std::vector<SentenceHit>> split(programs.size());
+        for(size_t b = 0; b < blocks.size(); ++b){
+            auto& queries = by_length[blocks[b].len];
+            for(size_t k = 0; k < found[b].size(); ++k)
+                split[queries[k]].insert(split[queries[k]].end(), found[b][k].begin(), found[b][k].end());
+            found[b] = {};
+        }
+        for(size_t q = 0; q < programs.size(); ++q){
+            if(!shared[q])
+                continue;
+            merge_runs(split[q], std::less<SentenceHit>());
+            results[q] = group_sorted_hits(split[q]);
+            stats[q].busy = busy;
+            stats[q].truncated = truncated;
+        }
+        return results;
+    }
+};
+
+// Number of leading lines of the window starting at line i that match.
+inline size_t window_prefix(const std::vector<MatchProgram>& programs, const std::vector<ReString>& sentences, size_t i){
+    size_t k = 0;
+    while(k < programs.size() && programs[k].match(sentences[i + k]))
+        ++k;
+    return k;
+}
+
+// Matches windows of consecutive lines, one program per line of the window,
+// in a single pass over each poem. A window is abandoned at the first line
+// that fails. Match positions are the first lines of matching windows.
+struct WindowExecutor{
+    ExecuteStats stats;
+    Page page;
+    const CancelToken* cancel = nullptr;
+
+    std::vector<QueryResult> execute(const std::vector<MatchProgram>& programs, const std::vector<PoetryItem>& items, const SentenceStore& store){
+        size_t width = programs.size();
+        size_t end = items.size();
+        auto results = scan_ordered(store, page.start, end, page.needed(), cancel, stats, [&](size_t first, size_t last, std::vector<QueryResult>& out){
+            size_t tested = 0;
+            for(size_t p = first; p < last; ++p){
+                auto& sentences = items[p].sentences;
+                QueryResult result{items[p].id, {}};
+                for(size_t i = 0; i + width <= sentences.size(); ++i){
+                    size_t k = window_prefix(programs, sentences, i);
+                    tested += std::min(k + 1, width);
+                    if(k == width)
+                        result.match_positions.push_back(i);
                 }
+                if(!result.match_positions.empty())
+                    out.push_back(std::move(result));
+            }
+            return tested;
+        });
+        page.apply(results, end, stats.truncated);
+        return results;
+    }
+};
+
+// Evaluates poem-level clauses while holding each poem's lines, emitting
+// only poems that satisfy every clause. A clause stops scanning as soon as
+// its quantifier is decided, and later clauses are skipped once one fails.
+// Match positions are the window starts of the first clause.
+struct PoemExecutor{
+    ExecuteStats stats;
+    Page page;
+    const CancelToken* cancel = nullptr;
+
+    static bool even_lines_rhyme(const std::vector<ReString>& sentences, std::vector<uint32_t>* positions, size_t& tested){
+        uint16_t group = 0;
+        size_t lines = 0;
+        for(size_t i = 1; i < sentences.size(); i += 2){
+            tested++;
+            if(sentences[i].empty())
+                return false;
+            auto g = ReString::getRhymeGroup(sentences[i].back());
+            if(g == 0 || (group != 0 && g != group))
+                return false;
+            group = g;
+            lines++;
+        }
+        if(lines < 2)
+            return false;
+        if(positions){
+            for(size_t i = 1; i < sentences.size(); i += 2)
+                positions->push_back((uint32_t)i);
+        }
+        return true;
+    }
+
+    static bool evaluate(const PoemClause& clause, const std::vector<MatchProgram>& programs, const std::vector<ReString>& sentences, std::vector<uint32_t>* positions, size_t& tested){
+        if(clause.quantifier == PoemClause::Rhyme)
+            return even_lines_rhyme(sentences, positions, tested);
+        size_t width = programs.size();
+        size_t starts = sentences.size() >= width ? sentences.size() - width + 1 : 0;
+        size_t matched = 0;
+        for(size_t i = 0; i < starts; ++i){
+            size_t k = window_prefix(programs, sentences, i);
+            tested += std::min(k + 1, width);
+            bool ok = k == width;
+            if(ok){
+                matched++;
+                if(positions)
+                    positions->push_back((uint32_t)i);
+            }
+            if(positions)
+                continue;
+            switch(clause.quantifier){
+                case PoemClause::Any:
+                    if(ok) return true;
+                    break;
+                case PoemClause::All:
+                    if(!ok) return false;
+                    break;
+                case PoemClause::AtLeast:
+                    if(matched >= clause.count) return true;
+                    break;
+                case PoemClause::AtMost: case PoemClause::Exactly:
+                    if(matched > clause.count) return false;
+                    break;
+                case PoemClause::Rhyme:
+                    break;
             }
         }
+        return clause.accepts(matched, starts);
+    }
+
+    // Augmenting path from clause u over the window starts each clause
+    // matched, so that every clause gets a start of its own.
+    static bool assign(size_t u, const std::vector<std::vector<uint32_t>>& witnesses, std::vector<int>& owner, std::vector<bool>& visited){
+        for(auto v : witnesses[u]){
+            if(visited[v])
+                continue;
+            visited[v] = true;
+            if(owner[v] < 0 || assign(owner[v], witnesses, owner, visited)){
+                owner[v] = (int)u;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool distinct_witnesses(const std::vector<std::vector<uint32_t>>& witnesses, size_t starts){
+        std::vector<int> owner(starts, -1);
+        for(size_t u = 0; u < witnesses.size(); ++u){
+            std::vector<bool> visited(starts, false);
+            if(!assign(u, witnesses, owner, visited))
+                return false;
+        }
+        return true;
+    }
+
+    std::vector<QueryResult> execute(const PoemQuery& query, const std::vector<std::vector<MatchProgram>>& programs, const std::vector<PoetryItem>& items, const SentenceStore& store){
+        // `any` clauses joined by ';' each need a line of their own.
+        std::vector<size_t> shared;
+        for(size_t c = 0; c < query.clauses.size(); ++c){
+            if(query.clauses[c].quantifier == PoemClause::Any)
+                shared.push_back(c);
+        }
+        if(shared.size() < 2)
+            shared.clear();
+        size_t end = items.size();
+        auto results = scan_ordered(store, page.start, end, page.needed(), cancel, stats, [&](size_t first, size_t last, std::vector<QueryResult>& out){
+            size_t tested = 0;
+            std::vector<std::vector<uint32_t>> witnesses(shared.size());
+            for(size_t p = first; p < last; ++p){
+                auto& sentences = items[p].sentences;
+                bool ok = true;
+                for(size_t c = 0; c < query.clauses.size() && ok; ++c)
+                    ok = evaluate(query.clauses[c], programs[c], sentences, nullptr, tested);
+                if(ok && !shared.empty()){
+                    for(size_t k = 0; k < shared.size(); ++k){
+                        witnesses[k].clear();
+                        evaluate(query.clauses[shared[k]], programs[shared[k]], sentences, &witnesses[k], tested);
+                    }
+                    ok = distinct_witnesses(witnesses, sentences.size());
+                }
+                if(!ok)
+                    continue;
+                QueryResult result{items[p].id, {}};
+                std::vector<uint32_t> positions;
+                evaluate(query.clauses[0], programs[0], sentences, &positions, tested);
+                result.match_positions.assign(positions.begin(), positions.end());
+                out.push_back(std::move(result));
+            }
+            return tested;
+        });
+        page.apply(results, end, stats.truncated);
         return results;
     }
-};
\ No newline at end of file
+};
+
+// Index of the first occurrence of `code` in [str + from, str + n), or n.
+inline size_t find_code(const uint16_t* str, size_t from, size_t n, uint16_t code){
+    size_t i = from;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i needle = _mm_set1_epi16((short)code);
+    for(; i + 8 <= n; i += 8){
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(chunk, needle));
+        if(mask)
+            return i + lowest_bit((uint64_t)mask) / 2;
+    }
+#endif
+    for(; i < n; ++i){
+        if(str[i] == code)
+            return i;
+    }
+    return n;
+}
+
+// Finds every sentence containing `needle` as a substring. With an n-gram
+// index the candidates come from postings intersection; otherwise, and for
+// single-code needles, the bucket arenas are scanned for the first code.
+struct SubstringExecutor{
+    static const size_t CHECK_EVERY = 4096;
+
+    ExecuteStats stats;
+    const CancelToken* cancel = nullptr;
+
+    static bool contains_at(const uint16_t* str, size_t pos, size_t len, const ReString& needle){
+        return pos + needle.size() <= len && std::memcmp(str + pos, needle.data(), needle.size() * sizeof(uint16_t)) == 0;
+    }
+
+    std::vector<QueryResult> execute(const ReString& needle, const SentenceStore& store, const NgramIndex* index = nullptr){
+        std::vector<SentenceHit> hits;
+        std::atomic<bool> truncated{false};
+        if(needle.empty() || store.buckets.empty())
+            return {};
+        if(index && needle.size() >= 2){
+            auto ids = index->candidates(needle);
+            for(size_t k = 0; k < ids.size(); ++k){
+                if(k % CHECK_EVERY == 0 && stop_requested(cancel, truncated))
+                    break;
+                auto id = ids[k];
+                auto& bucket = store.bucketOf(id);
+                size_t i = id - bucket.first_id;
+                const uint16_t* str = bucket.sentence(i);
+                for(size_t pos = find_code(str, 0, bucket.length, needle[0]); pos < bucket.length; pos = find_code(str, pos + 1, bucket.length, needle[0])){
+                    if(contains_at(str, pos, bucket.length, needle)){
+                        hits.push_back({bucket.poetry_ids[i], bucket.line_ids[i]});
+                        break;
+                    }
+                }
+            }
+            stats.scanned += ids.size();
+            stats.pruned += store.sentence_count - ids.size();
+            stats.truncated = truncated;
+            return group_hits(hits);
+        }
+
+        for(size_t len = 0; len < needle.size() && len <= store.maxLength(); ++len)
+            stats.pruned += store.buckets[len].size();
+        stats.scanned += store.sentence_count - stats.pruned;
+
+        std::vector<std::vector<SentenceHit>> found(store.maxLength() + 1);
+        size_t lengths = store.maxLength() + 1 > needle.size() ? store.maxLength() + 1 - needle.size() : 0;
+        parallel_for(lengths, [&](size_t k, size_t){
+            size_t len = needle.size() + k;
+            auto& bucket = store.buckets[len];
+            const uint16_t* arena = bucket.codes.data();
+            size_t n = bucket.codes.size();
+            for(size_t at = find_code(arena, 0, n, needle[0]), checked = 0; at < n; at = find_code(arena, at + 1, n, needle[0])){
+                size_t i = at / len;
+                if(i >= checked){
+                    if(stop_requested(cancel, truncated))
+                        break;
+                    checked = i + CHECK_EVERY;
+                }
+                if(contains_at(bucket.sentence(i), at % len, len, needle)){
+                    found[len].push_back({bucket.poetry_ids[i], bucket.line_ids[i]});
+                    at = (i + 1) * len - 1;
+                }
+            }
+        });
+        for(auto& local : found)
+            hits.insert(hits.end(), local.begin(), local.end());
+        merge_runs(hits, std::less<SentenceHit>());
+        stats.truncated = truncated;
+        return group_sorted_hits(hits);
+    }
+};
+
+// Lines within k edits of a pattern, ranked by distance. By the pigeonhole
+// principle such a line contains one of k + 1 disjoint pieces of the
+// pattern exactly, so only lines holding a piece (by the bigram index when
+// built, otherwise by every code of the piece) within m +- k characters are
+// verified with the bit-parallel distance.
+struct ApproximateExecutor{
+    static const int SCAN_BLOCK = 1024;
+
+    struct Hit{
+        uint32_t poetry_id;
+        uint32_t line_id;
+        int distance;
+    };
+
+    ExecuteStats stats;
+    const CancelToken* cancel = nullptr;
+
+    static RoaringBitmap piece_candidates(const ReString& piece, const CharPostings& postings, const NgramIndex* ngrams){
+        RoaringBitmap set;
+        if(ngrams && piece.size() >= 2){
+            for(auto id : ngrams->candidates(piece))
+                set.push_back(id);
+            return set;
+        }
+        for(size_t i = 0; i < piece.size(); ++i){
+            auto bitmap = postings.find(piece[i]);
+            if(!bitmap)
+                return {};
+            set = i == 0 ? *bitmap : RoaringBitmap::intersect(set, *bitmap);
+        }
+        return set;
+    }
+
+    std::vector<QueryResult> execute(const ReString& pattern, int k, const SentenceStore& store, const CharPostings& postings, const NgramIndex* ngrams = nullptr){
+        BitParallelDistance dist(pattern);
+        size_t m = pattern.size();
+        size_t lo = m > (size_t)k ? m - k : 1;
+        size_t hi = std::min(m + k, store.maxLength());
+
+        RoaringBitmap filter;
+        bool filtered = (size_t)k + 1 <= m;
+        for(size_t p = 0; filtered && p <= (size_t)k; ++p){
+            ReString piece;
+            piece.assign(pattern.begin() + p * m / (k + 1), pattern.begin() + (p + 1) * m / (k + 1));
+            filter = RoaringBitmap::unite(filter, piece_candidates(piece, postings, ngrams));
+        }
+
+        std::vector<Hit> hits;
+        std::atomic<bool> truncated{false};
+        for(size_t len = lo; len <= hi && !stop_requested(cancel, truncated); ++len){
+            auto& bucket = store.buckets[len];
+            std::vector<uint32_t> ids;
+            auto first = (uint32_t)bucket.first_id;
+            if(filtered)
+                filter.for_each_in_range(first, first + (uint32_t)bucket.size(), [&](uint32_t id){ ids.push_back(id - first); });
+            size_t count = filtered ? ids.size() : bucket.size();
+            stats.scanned += count;
+            stats.pruned += bucket.size() - count;
+
+            auto found = collect_ordered<Hit>((int)((count + SCAN_BLOCK - 1) / SCAN_BLOCK), stats.busy, [&](int b, std::vector<Hit>& buffer){
+                if(stop_requested(cancel, truncated))
+                    return;
+                size_t end = std::min(count, (size_t)(b + 1) * SCAN_BLOCK);
+                for(size_t c = (size_t)b * SCAN_BLOCK; c < end; ++c){
+                    size_t i = filtered ? ids[c] : c;
+                    int d = dist.distance(bucket.sentence(i), len, k);
+                    if(d <= k)
+                        buffer.push_back({bucket.poetry_ids[i], bucket.line_ids[i], d});
+                }
+            });
+            hits.insert(hits.end(), found.begin(), found.end());
+        }
+        stats.truncated = truncated;
+
+        std::sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b){
+            if(a.poetry_id != b.poetry_id)
+                return a.poetry_id < b.poetry_id;
+            return a.distance != b.distance ? a.distance < b.distance : a.line_id < b.line_id;
+        });
+        std::vector<QueryResult> results;
+        for(auto& hit : hits){
+            if(results.empty() || results.back().poetry_id != hit.poetry_id)
+                results.push_back({hit.poetry_id, {}, (double)hit.distance});
+            results.back().match_positions.push_back(hit.line_id);
+        }
+        std::stable_sort(results.begin(), results.end(), [](const QueryResult& a, const QueryResult& b){
+            return a.score < b.score;
+        });
+        return results;
+    }
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "database.h"
+#include "program.h"
+
+inline void appendVarint(std::vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline uint32_t readVarint(const uint8_t*& p) {
+    uint32_t value = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        value |= static_cast<uint32_t>(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= static_cast<uint32_t>(*p++) << shift;
+    return value;
+}
+
+// A sorted list of ids stored as varint encoded deltas in an index arena.
+struct PostingView {
+    const uint8_t* data = nullptr;
+    uint32_t count = 0;
+
+    template<typename F>
+    void forEach(F f) const {
+        const uint8_t* p = data;
+        uint32_t id = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            id += readVarint(p);
+            f(id);
+        }
+    }
+
+    std::vector<uint32_t> decode() const {
+        std::vector<uint32_t> ids;
+        ids.reserve(count);
+        forEach([&](uint32_t id) { ids.push_back(id); });
+        return ids;
+    }
+
+    // Keeps the ids of `ids` that also appear in this list.
+    void intersect(std::vector<uint32_t>& ids) const {
+        size_t keep = 0, i = 0;
+        forEach([&](uint32_t id) {
+            while (i < ids.size() && ids[i] < id) ++i;
+            if (i < ids.size() && ids[i] == id) ids[keep++] = ids[i++];
+        });
+        ids.resize(keep);
+    }
+};
+
+// Inverted index from (sentence length, position, code) to the sentences of
+// that length carrying the code at that position. Ids are local to the
+// length bucket.
+class PositionalIndex {
+public:
+    static constexpr size_t MAX_INDEXED_LENGTH = 64;
+
+    using Anchor = MatchProgram::Anchor;
+
+    void build(const SentenceStore& store);
+
+    bool empty() const {
+        return slots_.empty();
+    }
+
+    bool covers(size_t length) const {
+        return length < slots_.size();
+    }
+
+    PostingView find(size_t length, size_t pos, uint16_t code) const;
+
+    // Intersects the postings of the most selective anchors. Returns false
+    // when the index cannot narrow the bucket down.
+    bool candidates(size_t length, const std::vector<Anchor>& anchors, std::vector<uint32_t>& ids, size_t max_lists = 3) const;
+
+    size_t estimateMemoryUsage() const;
+
+private:
+    struct Slot {
+        std::vector<uint16_t> codes;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> counts;
+    };
+
+    std::vector<std::vector<Slot>> slots_;
+    std::vector<uint8_t> data_;
+};
+
+// Inverted index from adjacent code pairs to the global ids of the sentences
+// containing them. Longer needles are narrowed by intersecting the postings
+// of their bigrams and verified against the sentence text.
+class NgramIndex {
+public:
+    void build(const SentenceStore& store);
+
+    bool empty() const {
+        return keys_.empty();
+    }
+
+    PostingView find(uint16_t first, uint16_t second) const;
+
+    // Sentences that may contain `needle`, which needs at least two codes.
+    std::vector<uint32_t> candidates(const ReString& needle) const;
+
+    size_t estimateMemoryUsage() const;
+
+private:
+    static uint32_t key(uint16_t first, uint16_t second) {
+        return (static_cast<uint32_t>(first) << 16) | second;
+    }
+
+    std::vector<uint32_t> keys_;
+    std::vector<uint32_t> offsets_;
+    std::vector<uint32_t> counts_;
+    std::vector<uint8_t> data_;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <utility>
+#include <cstdint>
+
+#include "program.h"
+#include "database.h"
+
+// Matcher for programs that only test one leaf per position of a fixed
+// length-N window. The probes are unrolled at compile time and LANES
+// sentences of the bucket are tested per iteration without branching.
+template<size_t N>
+struct StaticKernel{
+    static const size_t LANES = 4;
+
+    const uint64_t* leaves[N];
+
+    explicit StaticKernel(const MatchProgram& program){
+        for(size_t p = 0; p < N; ++p)
+            leaves[p] = program.leaf_bits.data() + program.kernel_leaves[p] * program.leaf_stride;
+    }
+
+    template<size_t... P>
+    bool probe(const uint16_t* str, std::index_sequence<P...>) const{
+        return ((leaves[P][str[P] >> 6] >> (str[P] & 63)) & ...) & 1;
+    }
+
+    bool match(const uint16_t* str) const{
+        return probe(str, std::make_index_sequence<N>());
+    }
+
+    // Calls hit(i) for each matching sentence i in [begin, end) of the
+    // bucket, or for each ids[k] with k in [begin, end) when ids is given.
+    template<typename F>
+    void scan(const SentenceBucket& bucket, const uint32_t* ids, size_t begin, size_t end, F hit) const{
+        if(ids){
+            for(size_t k = begin; k < end; ++k){
+                if(match(bucket.sentence(ids[k])))
+                    hit(ids[k]);
+            }
+            return;
+        }
+        size_t i = begin;
+        for(; i + LANES <= end; i += LANES){
+            const uint16_t* str = bucket.sentence(i);
+            uint32_t mask = 0;
+            for(size_t lane = 0; lane < LANES; ++lane)
+                mask |= uint32_t(match(str + lane * N)) << lane;
+            while(mask){
+                hit(i + lowest_bit(mask));
+                mask &= mask - 1;
+            }
+        }
+        for(; i < end; ++i){
+            if(match(bucket.sentence(i)))
+                hit(i);
+        }
+    }
+};
+
+// Runs the program over a slice of a bucket, dispatching to a specialized
+// kernel when the program has the shape and the length has one.
+template<typename F>
+void scan_bucket(const MatchProgram& program, const SentenceBucket& bucket, const uint32_t* ids, size_t begin, size_t end, bool use_kernels, F hit){
+    if(use_kernels && program.kernel_leaves.size() == bucket.length){
+        switch(bucket.length){
+            case 4: StaticKernel<4>(program).scan(bucket, ids, begin, end, hit); return;
+            case 5: StaticKernel<5>(program).scan(bucket, ids, begin, end, hit); return;
+            case 7: StaticKernel<7>(program).scan(bucket, ids, begin, end, hit); return;
+            default: break;
+        }
+    }
+    for(size_t k = begin; k < end; ++k){
+        size_t i = ids ? ids[k] : k;
+        if(program.match(bucket.sentence(i), bucket.length))
+            hit(i);
+    }
+}
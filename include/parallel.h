@@ -0,0 +1,169 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "thread_pool.h"
+
+// Work is spread over the active thread pool, over OpenMP threads when
+// there is none and the library is built with OpenMP, or else runs on the
+// calling thread. Bodies receive a slot below max_threads() that no other
+// thread uses during the same call, for per-thread buffers.
+
+inline int max_threads(){
+    if(auto pool = ThreadPool::active())
+        return (int)pool->size();
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// Calls body(slot) once on each thread taking part.
+template<typename F>
+void parallel_run(F body){
+    if(auto pool = ThreadPool::active()){
+        pool->run(body);
+        return;
+    }
+#ifdef _OPENMP
+    #pragma omp parallel
+    body((size_t)omp_get_thread_num());
+#else
+    body(0);
+#endif
+}
+
+// Calls body(i, slot) for i in [0, n), claimed dynamically.
+template<typename F>
+void parallel_for(size_t n, F body){
+    if(auto pool = ThreadPool::active()){
+        std::atomic<size_t> next{0};
+        pool->run([&](size_t slot){
+            for(size_t i; (i = next.fetch_add(1)) < n;)
+                body(i, slot);
+        });
+        return;
+    }
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < (int)n; ++i)
+        body((size_t)i, (size_t)omp_get_thread_num());
+#else
+    for(size_t i = 0; i < n; ++i)
+        body(i, 0);
+#endif
+}
+
+// Cooperative stop for running work, polled between chunks so whatever
+// was found so far can still be returned. A token also stops once its
+// deadline passes or the token it was derived from stops.
+class CancelToken{
+public:
+    CancelToken() = default;
+
+    CancelToken(const CancelToken* parent, size_t timeout_ms): parent_(parent){
+        if(timeout_ms){
+            has_deadline_ = true;
+            deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        }
+    }
+
+    void cancel(){
+        cancelled_ = true;
+    }
+
+    bool stopped() const{
+        if(cancelled_.load(std::memory_order_relaxed))
+            return true;
+        if((has_deadline_ && std::chrono::steady_clock::now() >= deadline_) || (parent_ && parent_->stopped())){
+            cancelled_ = true;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    mutable std::atomic<bool> cancelled_{false};
+    const CancelToken* parent_ = nullptr;
+    bool has_deadline_ = false;
+    std::chrono::steady_clock::time_point deadline_;
+};
+
+// Milliseconds each thread spent running work items, to show how evenly
+// a query was spread.
+struct BusyTime{
+    std::vector<double> ms;
+
+    void prepare(){
+        if(ms.size() < (size_t)max_threads())
+            ms.resize(max_threads(), 0);
+    }
+
+    template<typename F>
+    void run(size_t slot, F work){
+        auto begin = std::chrono::steady_clock::now();
+        work();
+        ms[slot] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+};
+
+// Runs body(i, buffer) for i in [0, n), each a similar amount of work.
+// Items are claimed dynamically, so idle threads take over the rest of
+// the work, and each thread appends to a buffer of its own. The segment
+// each item produced is then copied to an offset given by a prefix sum
+// over the items, which keeps the output in the order of i.
+template<typename T, typename F>
+std::vector<T> collect_ordered(int n, BusyTime& busy, F body){
+    std::vector<std::vector<T>> buffers(max_threads());
+    std::vector<size_t> owner(n);
+    std::vector<size_t> begin(n), offsets(n + 1, 0);
+    busy.prepare();
+    parallel_for(n, [&](size_t i, size_t slot){
+        auto& buffer = buffers[slot];
+        busy.run(slot, [&]{
+            owner[i] = slot;
+            begin[i] = buffer.size();
+            body((int)i, buffer);
+            offsets[i + 1] = buffer.size() - begin[i];
+        });
+    });
+
+    for(int i = 0; i < n; ++i)
+        offsets[i + 1] += offsets[i];
+    std::vector<T> output(offsets[n]);
+    parallel_for(n, [&](size_t i, size_t){
+        auto& buffer = buffers[owner[i]];
+        std::copy(buffer.begin() + begin[i], buffer.begin() + begin[i] + (offsets[i + 1] - offsets[i]), output.begin() + offsets[i]);
+    });
+    return output;
+}
+
+// Sorts a sequence made of a few ascending runs by merging neighbouring
+// runs pairwise, in O(n log runs).
+template<typename T, typename Less>
+void merge_runs(std::vector<T>& items, Less less){
+    std::vector<size_t> bounds{0};
+    for(size_t i = 1; i < items.size(); ++i){
+        if(less(items[i], items[i - 1]))
+            bounds.push_back(i);
+    }
+    bounds.push_back(items.size());
+    while(bounds.size() > 2){
+        std::vector<size_t> merged{0};
+        for(size_t r = 0; r + 2 < bounds.size(); r += 2){
+            std::inplace_merge(items.begin() + bounds[r], items.begin() + bounds[r + 1], items.begin() + bounds[r + 2], less);
+            merged.push_back(bounds[r + 2]);
+        }
+        if(merged.back() != items.size())
+            merged.push_back(items.size());
+        bounds = std::move(merged);
+    }
+}
@@ -0,0 +1,534 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+
+#include "matcher.h"
+#include "automaton.h"
+
+// Flat instruction form of a compiled Matcher tree. Every instruction tests
+// a window of the sentence and either falls through to the next instruction
+// or jumps to its failure target, so matching a sentence is a single loop
+// over a small array with no recursion.
+struct MatchProgram{
+    enum Op : uint8_t{
+        Length,     // window length outside [arg, pos] -> target
+        Check,      // leaf arg rejects str[pos] -> target
+        Bipartite,  // block arg rejects the window starting at pos -> target
+        Automaton,  // automaton arg rejects str[pos..pos+span) -> target
+        BitParallel,// position automaton arg rejects str[pos..pos+span) -> target
+        Jump,       // -> target
+        Accept,
+        Reject,
+    };
+
+    struct Instr{
+        Op op;
+        uint32_t arg;
+        uint32_t pos;
+        uint32_t target;
+        // Length of the window an automaton runs over, 0 for the rest of
+        // the sentence.
+        uint32_t span = 0;
+    };
+
+    struct Block{
+        uint32_t first_leaf;
+        uint32_t count;
+    };
+
+    // A single-code check every match must pass, at a fixed offset from the
+    // start of the sentence.
+    struct Anchor{
+        uint32_t pos;
+        uint16_t code;
+    };
+
+    static const uint32_t MAX_BLOCK_SIZE = 32;
+    static const size_t MAX_REQUIRED_CODES = 64;
+
+    std::vector<Instr> code;
+    std::vector<uint64_t> leaf_bits;
+    std::vector<float> leaf_pass;
+    size_t leaf_stride = 0;
+    size_t leaf_count = 0;
+    std::vector<Block> blocks;
+    std::vector<Dfa> automata;
+    std::vector<GlushkovAutomaton> position_automata;
+    std::vector<MatchProgram> subprograms;
+    std::vector<Anchor> anchors;
+    // Code sets every matching sentence contains at least one member of.
+    std::vector<std::vector<uint16_t>> required;
+    // Leaf tested at each position when the program is nothing but one
+    // check per position of a fixed length window, empty otherwise.
+    std::vector<uint32_t> kernel_leaves;
+
+    size_t length_lower_bound = 0, length_upper_bound = 0;
+
+    template<typename T>
+    static MatchProgram lower(const Matcher<T>& matcher);
+
+    bool test(uint32_t leaf, uint16_t code) const{
+        return (leaf_bits[leaf * leaf_stride + (code >> 6)] >> (code & 63)) & 1;
+    }
+
+    bool match(const uint16_t* str, size_t len) const{
+        const Instr* ins = code.data();
+        size_t pc = 0;
+        while(true){
+            const Instr& cur = ins[pc];
+            switch(cur.op){
+                case Length:
+                    pc = (len < cur.arg || len > cur.pos) ? cur.target : pc + 1;
+                    break;
+                case Check:
+                    pc = test(cur.arg, str[cur.pos]) ? pc + 1 : cur.target;
+                    break;
+                case Bipartite:
+                    pc = bipartite_match(blocks[cur.arg], str + cur.pos) ? pc + 1 : cur.target;
+                    break;
+                case Automaton:
+                    pc = automata[cur.arg].match(str + cur.pos, cur.span ? cur.span : len - cur.pos) ? pc + 1 : cur.target;
+                    break;
+                case BitParallel:
+                    pc = position_automata[cur.arg].match(str + cur.pos, cur.span ? cur.span : len - cur.pos,
+                        [this](uint32_t block, const uint16_t* window, size_t n){
+                            return subprograms[block].match(window, n);
+                        }) ? pc + 1 : cur.target;
+                    break;
+                case Jump:
+                    pc = cur.target;
+                    break;
+                case Accept:
+                    return true;
+                case Reject:
+                    return false;
+            }
+        }
+    }
+
+    bool match(const ReString& str) const{
+        return match(str.data(), str.size());
+    }
+
+    std::vector<size_t> batch_match(const std::vector<ReString>& sentences) const{
+        std::vector<size_t> result;
+        for(size_t i = 0; i < sentences.size(); ++i){
+            if(match(sentences[i])){
+                result.push_back(i);
+            }
+        }
+        return result;
+    }
+
+    // Perfect matching between the window and the block's conditions. The
+    // adjacency of each position is a bitmask over conditions, so this runs
+    // on the stack with no allocation.
+    bool bipartite_match(const Block& block, const uint16_t* str) const{
+        uint32_t adj[MAX_BLOCK_SIZE];
+        int8_t owner[MAX_BLOCK_SIZE];
+        uint32_t n = block.count;
+        uint32_t cover = 0;
+        for(uint32_t i = 0; i < n; ++i){
+            uint32_t mask = 0;
+            for(uint32_t j = 0; j < n; ++j)
+                mask |= uint32_t(test(block.first_leaf + j, str[i])) << j;
+            if(!mask)
+                return false;
+            adj[i] = mask;
+            cover |= mask;
+            owner[i] = -1;
+        }
+        if(cover != (n == 32 ? ~uint32_t(0) : (uint32_t(1) << n) - 1))
+            return false;
+
+        for(uint32_t u = 0; u < n; ++u){
+            uint32_t visited = 0;
+            if(!augment(u, adj, owner, visited))
+                return false;
+        }
+        return true;
+    }
+
+    static bool augment(uint32_t u, const uint32_t* adj, int8_t* owner, uint32_t& visited){
+        uint32_t cand = adj[u] & ~visited;
+        while(cand){
+            int v = lowest_bit(cand);
+            visited |= uint32_t(1) << v;
+            if(owner[v] < 0 || augment(owner[v], adj, owner, visited)){
+                owner[v] = (int8_t)u;
+                return true;
+            }
+            cand = adj[u] & ~visited;
+        }
+        return false;
+    }
+
+    std::string to_string() const{
+        static const char* names[] = {"LENGTH", "CHECK", "BIPARTITE", "AUTOMATON", "BITPARALLEL", "JUMP", "ACCEPT", "REJECT"};
+        std::string res;
+        for(size_t pc = 0; pc < code.size(); ++pc){
+            auto& cur = code[pc];
+            res += std::to_string(pc) + ": " + names[cur.op];
+            switch(cur.op){
+                case Length:
+                    res += " [" + std::to_string(cur.arg) + ", " + std::to_string(cur.pos) + "]";
+                    res += " else " + std::to_string(cur.target);
+                    break;
+                case Check:{
+                    char pass[32];
+                    std::snprintf(pass, sizeof(pass), " p=%.3g", leaf_pass[cur.arg]);
+                    res += " #" + std::to_string(cur.arg) + " @" + std::to_string(cur.pos);
+                    res += " else " + std::to_string(cur.target) + pass;
+                    break;
+                }
+                case Bipartite: case Automaton: case BitParallel:
+                    res += " #" + std::to_string(cur.arg) + " @" + std::to_string(cur.pos);
+                    if(cur.span)
+                        res += "+" + std::to_string(cur.span);
+                    res += " else " + std::to_string(cur.target);
+                    break;
+                case Jump:
+                    res += " " + std::to_string(cur.target);
+                    break;
+                default:
+                    break;
+            }
+            res += "\n";
+        }
+        for(size_t i = 0; i < automata.size(); ++i){
+            res += "automaton #" + std::to_string(i) + ": " + std::to_string(automata[i].state_count()) + " states, ";
+            res += std::to_string(automata[i].class_count) + " classes\n";
+        }
+        for(size_t i = 0; i < position_automata.size(); ++i){
+            res += "position automaton #" + std::to_string(i) + ": " + std::to_string(position_automata[i].position_count - 1) + " positions\n";
+        }
+        for(size_t i = 0; i < subprograms.size(); ++i){
+            res += "block #" + std::to_string(i) + ":\n" + subprograms[i].to_string();
+        }
+        return res;
+    }
+};
+
+template<typename T>
+struct MatchLowering{
+    using M = Matcher<T>;
+
+    struct Window{
+        uint32_t offset;
+        uint32_t length;
+        bool fixed;
+    };
+
+    // Estimated probability that a sentence passes a matcher, and the
+    // expected number of leaf tests spent finding out.
+    struct Estimate{
+        double pass;
+        double cost;
+    };
+
+    MatchProgram program;
+    std::vector<uint32_t> labels;
+    int branch_depth = 0;
+    double total_frequency = 0;
+    // Leaf bitmaps already placed in the program and their estimated pass
+    // rates, keyed by the bitmap they were compiled from.
+    std::map<const std::vector<bool>*, uint32_t> leaf_ids;
+    std::map<const std::vector<bool>*, double> selectivity;
+
+    uint32_t new_label(){
+        labels.push_back(0);
+        return (uint32_t)labels.size() - 1;
+    }
+
+    void bind(uint32_t label){
+        labels[label] = (uint32_t)program.code.size();
+    }
+
+    void resolve(){
+        for(auto& cur : program.code){
+            if(cur.op != MatchProgram::Accept && cur.op != MatchProgram::Reject)
+                cur.target = labels[cur.target];
+        }
+    }
+
+    void measure(const M& m, size_t& alphabet){
+        if(m.cache)
+            alphabet = std::max(alphabet, m.cache->size());
+        for(auto& sub : m.sub_matcher)
+            measure(sub, alphabet);
+    }
+
+    // Share of corpus characters the leaf accepts, or of the alphabet when no
+    // corpus is loaded.
+    double leaf_selectivity(const M& m){
+        auto found = selectivity.find(m.cache.get());
+        if(found != selectivity.end())
+            return found->second;
+        auto& leaf = *m.cache;
+        auto& freq = ReString::code_frequency;
+        double hit = 0;
+        size_t count = 0;
+        for(size_t code = 0; code < leaf.size(); ++code){
+            if(!leaf[code])
+                continue;
+            count++;
+            if(code < freq.size())
+                hit += freq[code];
+        }
+        double pass = total_frequency > 0 ? hit / total_frequency : leaf.empty() ? 1.0 : (double)count / leaf.size();
+        selectivity.emplace(m.cache.get(), pass);
+        return pass;
+    }
+
+    Estimate estimate(const M& m){
+        switch(m.strategy){
+            case M::Single:
+                return {leaf_selectivity(m), 1};
+            case M::Static: case M::And:{
+                Estimate total;
+                order(m, true, &total);
+                return total;
+            }
+            case M::Or:{
+                Estimate total;
+                order(m, false, &total);
+                return total;
+            }
+            case M::Bipartite:{
+                double n = (double)m.sub_matcher.size(), pass = 1;
+                for(auto& sub : m.sub_matcher)
+                    pass *= std::min(1.0, n * leaf_selectivity(sub));
+                return {pass, n};
+            }
+            case M::Not:{
+                auto e = estimate(m.sub_matcher[0]);
+                return {1 - e.pass, e.cost};
+            }
+            default:
+                return {0.5, 4.0 + std::min<size_t>(m.length_lower_bound, 16)};
+        }
+    }
+
+    // Evaluation order of the children: for conjunctions the ones most likely
+    // to reject per unit of cost come first, for disjunctions the ones most
+    // likely to accept. Ties keep the parse order.
+    std::vector<size_t> order(const M& m, bool conjunctive, Estimate* total = nullptr){
+        std::vector<Estimate> est;
+        std::vector<size_t> idx;
+        for(size_t i = 0; i < m.sub_matcher.size(); ++i){
+            est.push_back(estimate(m.sub_matcher[i]));
+            idx.push_back(i);
+        }
+        auto rank = [&](size_t i){
+            double decisive = conjunctive ? 1 - est[i].pass : est[i].pass;
+            return decisive / std::max(est[i].cost, 1e-9);
+        };
+        std::stable_sort(idx.begin(), idx.end(), [&](size_t a, size_t b){
+            return rank(a) > rank(b);
+        });
+        if(total){
+            double reach = 1, cost = 0;
+            for(auto i : idx){
+                cost += reach * est[i].cost;
+                reach *= conjunctive ? est[i].pass : 1 - est[i].pass;
+            }
+            *total = {conjunctive ? reach : 1 - reach, cost};
+        }
+        return idx;
+    }
+
+    uint32_t add_leaf(const M& m){
+        auto stride = program.leaf_stride;
+        program.leaf_bits.resize((program.leaf_count + 1) * stride, 0);
+        uint64_t* bits = program.leaf_bits.data() + program.leaf_count * stride;
+        auto& leaf = *m.cache;
+        for(size_t code = 0; code < leaf.size(); ++code){
+            if(leaf[code])
+                bits[code >> 6] |= uint64_t(1) << (code & 63);
+        }
+        program.leaf_pass.push_back((float)leaf_selectivity(m));
+        return (uint32_t)program.leaf_count++;
+    }
+
+    // Leaf for a standalone check, shared by every check of the same bitmap.
+    // Blocks need their leaves contiguous and use add_leaf directly.
+    uint32_t shared_leaf(const M& m){
+        auto found = leaf_ids.find(m.cache.get());
+        if(found != leaf_ids.end())
+            return found->second;
+        auto id = add_leaf(m);
+        leaf_ids.emplace(m.cache.get(), id);
+        return id;
+    }
+
+    // Records a leaf every accepting path checks: as an anchor when it is a
+    // single code at a known offset, and as a required code set when small.
+    void add_requirement(const M& m, const Window& win, bool anchored){
+        if(branch_depth > 0)
+            return;
+        std::vector<uint16_t> codes;
+        auto& leaf = *m.cache;
+        for(size_t c = 0; c < leaf.size(); ++c){
+            if(!leaf[c])
+                continue;
+            if(codes.size() == MatchProgram::MAX_REQUIRED_CODES)
+                return;
+            codes.push_back((uint16_t)c);
+        }
+        if(anchored && codes.size() == 1)
+            program.anchors.push_back({win.offset, codes[0]});
+        program.required.push_back(std::move(codes));
+    }
+
+    void detect_kernel(){
+        auto& code = program.code;
+        size_t n = program.length_lower_bound;
+        if(n == 0 || n != program.length_upper_bound || code.size() < n + 2)
+            return;
+        size_t first = code[0].op == MatchProgram::Length ? 1 : 0;
+        if(code.size() != first + n + 2 || code[first + n].op != MatchProgram::Accept)
+            return;
+        std::vector<uint32_t> leaves(n, UINT32_MAX);
+        for(size_t pc = first; pc < first + n; ++pc){
+            if(code[pc].op != MatchProgram::Check || code[pc].pos >= n || leaves[code[pc].pos] != UINT32_MAX)
+                return;
+            leaves[code[pc].pos] = code[pc].arg;
+        }
+        program.kernel_leaves = std::move(leaves);
+    }
+
+    // Inside a fixed window an automaton must consume exactly the window,
+    // not the rest of the sentence.
+    static uint32_t span(const Window& win){
+        return win.fixed ? win.length : 0;
+    }
+
+    void emit_length(const M& m, const Window& win, uint32_t fail){
+        if(!win.fixed){
+            program.code.push_back({MatchProgram::Length, (uint32_t)m.length_lower_bound, (uint32_t)m.length_upper_bound, fail});
+        }
+    }
+
+    void emit_position_automaton(const M& m, const Window& win, uint32_t fail){
+        std::vector<const M*> blocks;
+        auto automaton = GlushkovAutomaton::build(m, blocks);
+        uint32_t base = (uint32_t)program.subprograms.size();
+        for(auto& e : automaton.exits)
+            e.block += base;
+        for(auto block : blocks)
+            program.subprograms.push_back(MatchProgram::lower(*block));
+        program.position_automata.push_back(std::move(automaton));
+        program.code.push_back({MatchProgram::BitParallel, (uint32_t)program.position_automata.size() - 1, win.offset, fail, span(win)});
+    }
+
+    void emit(const M& m, const Window& win, uint32_t fail){
+        switch(m.strategy){
+            case M::Single:{
+                emit_length(m, win, fail);
+                add_requirement(m, win, true);
+                program.code.push_back({MatchProgram::Check, shared_leaf(m), win.offset, fail});
+                break;
+            }
+            case M::Static:{
+                emit_length(m, win, fail);
+                std::vector<uint32_t> offsets;
+                uint32_t offset = win.offset;
+                for(auto& sub : m.sub_matcher){
+                    offsets.push_back(offset);
+                    offset += (uint32_t)sub.length_lower_bound;
+                }
+                for(auto i : order(m, true)){
+                    auto& sub = m.sub_matcher[i];
+                    emit(sub, Window{offsets[i], (uint32_t)sub.length_lower_bound, true}, fail);
+                }
+                break;
+            }
+            case M::Bipartite:{
+                if(m.sub_matcher.size() > MatchProgram::MAX_BLOCK_SIZE)
+                    throw std::runtime_error("unordered list supports at most " + std::to_string(MatchProgram::MAX_BLOCK_SIZE) + " conditions");
+                emit_length(m, win, fail);
+                MatchProgram::Block block{(uint32_t)program.leaf_count, (uint32_t)m.sub_matcher.size()};
+                for(auto& sub : m.sub_matcher){
+                    add_requirement(sub, win, false);
+                    add_leaf(sub);
+                }
+                program.blocks.push_back(block);
+                program.code.push_back({MatchProgram::Bipartite, (uint32_t)program.blocks.size() - 1, win.offset, fail});
+                break;
+            }
+            case M::And:{
+                for(auto i : order(m, true))
+                    emit(m.sub_matcher[i], win, fail);
+                break;
+            }
+            case M::Or:{
+                branch_depth++;
+                auto success = new_label();
+                auto idx = order(m, false);
+                for(size_t k = 0; k + 1 < idx.size(); ++k){
+                    auto next = new_label();
+                    emit(m.sub_matcher[idx[k]], win, next);
+                    program.code.push_back({MatchProgram::Jump, 0, 0, success});
+                    bind(next);
+                }
+                emit(m.sub_matcher[idx.back()], win, fail);
+                bind(success);
+                branch_depth--;
+                break;
+            }
+            case M::Not:{
+                emit_length(m, win, fail);
+                auto rejected = new_label();
+                branch_depth++;
+                emit(m.sub_matcher[0], win, rejected);
+                branch_depth--;
+                program.code.push_back({MatchProgram::Jump, 0, 0, fail});
+                bind(rejected);
+                break;
+            }
+            case M::Multi: case M::Regex:{
+                if(!m.is_support_regex()){
+                    emit_position_automaton(m, win, fail);
+                    break;
+                }
+                try{
+                    program.automata.push_back(Dfa::build(m));
+                    program.code.push_back({MatchProgram::Automaton, (uint32_t)program.automata.size() - 1, win.offset, fail, span(win)});
+                }catch(const std::runtime_error&){
+                    emit_position_automaton(m, win, fail);
+                }
+                break;
+            }
+            case M::Dynamic:{
+                emit_position_automaton(m, win, fail);
+                break;
+            }
+        }
+    }
+};
+
+template<typename T>
+MatchProgram MatchProgram::lower(const Matcher<T>& matcher){
+    MatchLowering<T> lowering;
+    for(auto count : ReString::code_frequency)
+        lowering.total_frequency += count;
+    lowering.program.length_lower_bound = matcher.length_lower_bound;
+    lowering.program.length_upper_bound = matcher.length_upper_bound;
+
+    size_t alphabet = 0;
+    lowering.measure(matcher, alphabet);
+    lowering.program.leaf_stride = (alphabet + 63) / 64;
+
+    auto fail = lowering.new_label();
+    lowering.emit(matcher, {0, 0, false}, fail);
+    lowering.program.code.push_back({Accept, 0, 0, 0});
+    lowering.bind(fail);
+    lowering.program.code.push_back({Reject, 0, 0, 0});
+    lowering.resolve();
+    lowering.detect_kernel();
+    return std::move(lowering.program);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "cond_parser.h"
+
+// Conditions on consecutive lines of a poem, written `A / B / ...`: a
+// window starting at line i matches when line i matches A, line i + 1
+// matches B, and so on. A query without '/' is a window of one line.
+struct LineWindow{
+    std::vector<std::shared_ptr<CondList>> lines;
+
+    size_t size() const {
+        return lines.size();
+    }
+
+    std::string toString() const;
+};
+
+LineWindow parseLineWindow(const std::vector<cond_token>& tokens, size_t pos, size_t pos_end);
+LineWindow parseWindowQuery(const std::string& queryStr);
+
+// A poem-level condition on a line window: `any:` (the default), `all:`,
+// or `count>=k:`, `count<=k:`, `count=k:` on the number of window starts
+// in the poem that match. The bare clause `rhyme` has no window and holds
+// when the poem's even-numbered lines, at least two, end in one rhyme
+// group.
+struct PoemClause{
+    enum Quantifier{
+        Any,
+        All,
+        AtLeast,
+        AtMost,
+        Exactly,
+        Rhyme,
+    };
+
+    Quantifier quantifier = Any;
+    size_t count = 1;
+    bool quantified = false;
+    LineWindow window;
+
+    // Whether `matched` matching starts out of `positions` satisfy the clause.
+    bool accepts(size_t matched, size_t positions) const {
+        switch(quantifier){
+            case Any: return matched > 0;
+            case All: return positions > 0 && matched == positions;
+            case AtLeast: return matched >= count;
+            case AtMost: return matched <= count;
+            case Exactly: return matched == count;
+            case Rhyme: return matched > 0;
+        }
+        return false;
+    }
+
+    std::string toString() const;
+};
+
+// Clauses separated by ';', all of which a poem must satisfy. A query with
+// one clause and no quantifier is not scoped and matches single windows.
+// Several `any:` clauses must each match at a different line.
+struct PoemQuery{
+    std::vector<PoemClause> clauses;
+
+    bool scoped() const {
+        return clauses.size() > 1 || clauses[0].quantified;
+    }
+
+    std::string toString() const;
+};
+
+PoemClause parsePoemClause(const std::vector<cond_token>& tokens, size_t pos, size_t pos_end);
+PoemQuery parsePoemQuery(const std::string& queryStr);
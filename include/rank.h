@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <string>
+
+#include "database.h"
+#include "executor.h"
+
+// Ranking key of a result, lower first.
+using ScoreFunction = std::function<double(const PoetryItem&, const QueryResult&)>;
+
+// Mean frequency level of the characters of the matched lines, so lines of
+// common characters come first. Characters without data count as rare.
+inline double frequency_score(const PoetryItem& item, const QueryResult& result){
+    double total = 0;
+    size_t count = 0;
+    for(auto line : result.match_positions){
+        if(line >= item.sentences.size())
+            continue;
+        for(auto code : item.sentences[line]){
+            auto it = ReString::hanzi_data.find(code);
+            total += it != ReString::hanzi_data.end() ? it->second.frequency : 5;
+            count++;
+        }
+    }
+    return count ? total / count : 5;
+}
+
+// Number of characters of the poem, shorter first.
+inline double length_score(const PoetryItem& item, const QueryResult&){
+    return (double)item.content.size();
+}
+
+// Popularity column of the CSV, higher first.
+inline double popularity_score(const PoetryItem& item, const QueryResult&){
+    return -item.popularity;
+}
+
+// Number of poems of the author in the corpus, prolific authors first.
+struct AuthorScore{
+    std::shared_ptr<std::unordered_map<std::string, size_t>> poems;
+
+    explicit AuthorScore(const std::vector<PoetryItem>& items)
+        : poems(std::make_shared<std::unordered_map<std::string, size_t>>()){
+        for(auto& item : items)
+            (*poems)[item.author]++;
+    }
+
+    double operator()(const PoetryItem& item, const QueryResult&) const{
+        auto it = poems->find(item.author);
+        return it != poems->end() ? -(double)it->second : 0;
+    }
+};
+
+inline bool ranks_before(const QueryResult& a, const QueryResult& b){
+    return a.score != b.score ? a.score < b.score : a.poetry_id < b.poetry_id;
+}
+
+// The k results with the lowest scores, in order, ties broken by poem id.
+// Each thread keeps a bounded max-heap of its best k and the heaps are
+// merged at the end, so only k results are ever sorted.
+inline std::vector<QueryResult> top_k(std::vector<QueryResult> results, size_t k, const std::vector<PoetryItem>& items, const ScoreFunction& score){
+    std::vector<QueryResult> best;
+    if(k == 0)
+        return best;
+
+    auto offer = [k](std::vector<QueryResult>& heap, QueryResult& result){
+        if(heap.size() < k){
+            heap.push_back(std::move(result));
+            std::push_heap(heap.begin(), heap.end(), ranks_before);
+        }else if(ranks_before(result, heap.front())){
+            std::pop_heap(heap.begin(), heap.end(), ranks_before);
+            heap.back() = std::move(result);
+            std::push_heap(heap.begin(), heap.end(), ranks_before);
+        }
+    };
+
+    std::vector<std::vector<QueryResult>> heaps(max_threads());
+    std::atomic<size_t> next{0};
+    parallel_run([&](size_t slot){
+        const size_t BATCH = 256;
+        auto& heap = heaps[slot];
+        for(size_t first; (first = next.fetch_add(BATCH)) < results.size();){
+            for(size_t i = first; i < std::min(first + BATCH, results.size()); ++i){
+                auto& result = results[i];
+                result.score = score(items[result.poetry_id], result);
+                offer(heap, result);
+            }
+        }
+    });
+    for(auto& heap : heaps){
+        for(auto& result : heap)
+            offer(best, result);
+    }
+    std::sort_heap(best.begin(), best.end(), ranks_before);
+    return best;
+}
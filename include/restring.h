@@ -36,6 +36,15 @@ struct ReString : std::vector<uint16_t> {
 
     static std::unordered_map<uint16_t, HanziData> hanzi_data;
 
+    // Occurrences of each code in the loaded corpus, indexed by code.
+    static std::vector<uint32_t> code_frequency;
+
+    // Rhyme group of each code by its first reading, indexed by code:
+    // final id << 1 | 1 for oblique tones, 0 without a toned reading.
+    // Final ids index rhyme_finals, whose entry 0 is unused.
+    static std::vector<uint16_t> rhyme_group;
+    static std::vector<std::string> rhyme_finals;
+
     ReString() = default;
     ReString(const std::string& s, bool create_new = true);
 
@@ -64,6 +73,14 @@ struct ReString : std::vector<uint16_t> {
     static bool loadHanziData(const std::string& filename);
 
     static HanziData& getHanziData(uint16_t code);
+
+    // Final of a pinyin syllable without initial, medial or tone, e.g.
+    // "ang" for both "guang1" and "yang2".
+    static std::string pinyinFinal(const std::string& pinyin);
+
+    static int getRhymeFinal(const std::string& final);
+
+    static uint16_t getRhymeGroup(uint16_t code);
 };
 
 struct HanziData {
@@ -72,6 +89,9 @@ struct HanziData {
     ReString traditional;
     int strokes;
     std::vector<std::string> pinyin;
+    // Bit t is set when some reading has tone t, 0 standing for neutral.
+    uint8_t tones = 0;
+    uint8_t first_tone = 0;
     ReString radicals;
     int frequency;
     std::string structure;
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads shared by loading, index building and query
+// execution. A pool of size n keeps n - 1 workers; the thread calling
+// run() takes part as well, so a parallel run never waits for a worker
+// to become free and may safely be started from inside a task.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = 0, bool pin = false);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Replaces the workers. 0 uses every hardware thread. With pin, worker
+    // i stays on the i-th CPU the process may run on, where supported.
+    // Throws while a Scope uses the pool, a task is queued or running, or
+    // a parallel run is in progress. run, submit and Scope throw while the
+    // workers are replaced.
+    void resize(size_t threads, bool pin = false);
+
+    // Runs the queued tasks to completion and joins the workers; the pool
+    // then runs everything on the calling thread.
+    void stop();
+
+    size_t size() const { return size_; }
+    bool pinned() const { return pinned_; }
+
+    // Calls body(slot) on the calling thread and on every worker that is
+    // idle before the calling thread returns from it, each with a distinct
+    // slot below size(), and waits for all of them. body should claim its
+    // work from shared state, since any number of workers may join. The
+    // first exception thrown by any of them is rethrown here.
+    void run(const std::function<void(size_t)>& body);
+
+    // Queues a task for a worker, or runs it at once without workers.
+    // then, if given, is called after the task once it no longer counts as
+    // running, so whoever it wakes may resize the pool straight away.
+    template<typename F>
+    auto submit(F task, std::function<void()> then = nullptr) -> std::future<decltype(task())> {
+        using R = decltype(task());
+        auto packaged = std::make_shared<std::packaged_task<R()>>(std::move(task));
+        auto future = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            checkResizing();
+            if (!workers_.empty()) {
+                tasks_.push_back({[packaged] { (*packaged)(); }, std::move(then)});
+                ++busy_;
+                wake_.notify_one();
+                return future;
+            }
+        }
+        (*packaged)();
+        if (then) {
+            then();
+        }
+        return future;
+    }
+
+    // Pool that parallel_for and parallel_run use on this thread: the
+    // innermost Scope, or the pool a worker belongs to. nullptr falls back
+    // to OpenMP when built with it, otherwise to the calling thread alone.
+    // A Scope keeps its pool from being resized until it ends.
+    static ThreadPool* active();
+
+    class Scope {
+    public:
+        explicit Scope(ThreadPool* pool);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        ThreadPool* pool_;
+        ThreadPool* saved_;
+    };
+
+private:
+    struct Task {
+        std::function<void()> body, then;
+    };
+
+    struct Job {
+        const std::function<void(size_t)>* body;
+        size_t slots = 1;
+        size_t next_slot = 1;
+        size_t running = 0;
+        std::exception_ptr error;
+    };
+
+    void work();
+    // Called with mutex_ held.
+    void checkResizing() const;
+
+    std::vector<std::thread> workers_;
+    bool pinned_ = false;
+    bool stopping_ = false;
+    bool resizing_ = false;
+    std::atomic<size_t> size_{1};
+    // Live scopes, queued or running tasks and parallel runs in progress.
+    size_t busy_ = 0;
+    std::mutex mutex_;
+    std::condition_variable wake_, done_;
+    std::deque<std::shared_ptr<Job>> jobs_;
+    std::deque<Task> tasks_;
+};
@@ -16,6 +16,20 @@ std::pair<uint32_t, uint32_t> readUTF8Char(const std::string& str, size_t& pos,
     return {cp, (uint32_t)len};
 }
 
+// Reading policy named by the suffix of a tone atom or pattern keyword:
+// none for any reading, 'a' for every reading, '1' for the first reading.
+static bool parseTonePolicy(const std::string& suffix, ToneCond::Policy& policy){
+    if(suffix.empty())
+        policy = ToneCond::AnyReading;
+    else if(suffix == "a")
+        policy = ToneCond::EveryReading;
+    else if(suffix == "1")
+        policy = ToneCond::FirstReading;
+    else
+        return false;
+    return true;
+}
+
 std::shared_ptr<BaseCond> parseBaseCond(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end){
     std::shared_ptr<BaseCond> baseCond = nullptr;
 
@@ -47,6 +61,35 @@ std::shared_ptr<BaseCond> parseBaseCond(const std::vector<cond_token>& tokens, s
         }
         baseCond = std::make_shared<StructCond>(structToken.value);
         pos++;
+    }else if(token.type == cond_token::TokenType::Percent){
+        pos++;
+        ToneCond::Policy policy;
+        if(pos >= pos_end || tokens[pos].type != cond_token::TokenType::Letters)
+            throw ParseException("expected tone after '%'", token.original_pos.first, token.original_pos.second);
+        auto& toneToken = tokens[pos];
+        auto& value = toneToken.value;
+        if((value[0] != 'p' && value[0] != 'z') || !parseTonePolicy(value.substr(1), policy))
+            throw ParseException("invalid tone: " + value, toneToken.original_pos.first, toneToken.original_pos.second);
+        baseCond = std::make_shared<ToneCond>(value[0] == 'p' ? ToneCond::Level : ToneCond::Oblique, policy);
+        pos++;
+    }else if(token.type == cond_token::TokenType::Tilde){
+        pos++;
+        if(pos >= pos_end || (tokens[pos].type != cond_token::TokenType::Letters && tokens[pos].type != cond_token::TokenType::Char))
+            throw ParseException("expected rhyme or character after '~'", token.original_pos.first, token.original_pos.second);
+        auto& rhymeToken = tokens[pos];
+        if(rhymeToken.type == cond_token::TokenType::Char){
+            uint32_t ch = ReString::nextUtf8Codepoint(rhymeToken.value, 0).first;
+            auto group = ReString::getRhymeGroup(ReString::getCode(ch));
+            if(group == 0)
+                throw ParseException("no rhyme known for " + rhymeToken.value, rhymeToken.original_pos.first, rhymeToken.original_pos.second);
+            baseCond = std::make_shared<RhymeCond>(group, true);
+        }else{
+            int final = ReString::getRhymeFinal(ReString::pinyinFinal(rhymeToken.value));
+            if(final < 0)
+                throw ParseException("unknown rhyme: " + rhymeToken.value, rhymeToken.original_pos.first, rhymeToken.original_pos.second);
+            baseCond = std::make_shared<RhymeCond>((uint16_t)(final << 1), false);
+        }
+        pos++;
     }else if(token.type == cond_token::TokenType::Number){
         int strokes = std::stoi(token.value);
         baseCond = std::make_shared<StrokeCond>(strokes);
@@ -83,6 +126,13 @@ std::shared_ptr<CombCond> parseCombCond(const std::vector<cond_token>& tokens, s
         }else if(token.type == cond_token::TokenType::Comma){
             pos++;
             flash = true;
+        }else if(token.type == cond_token::TokenType::Not){
+            pos++;
+            cond_ptr baseCond = parseBaseCond(tokens, pos, pos_end);
+            if(auto chaiziCond = as_chaizi_cond(std::dynamic_pointer_cast<BaseCond>(baseCond)))
+                baseCond = chaiziCond;
+            combCond->conds.push_back(std::make_shared<NotCond>(baseCond));
+            flash = false;
         }else {
             auto baseCond = parseBaseCond(tokens, pos, pos_end);
             
@@ -119,6 +169,10 @@ std::shared_ptr<OptionCond> parseOptionCond(const std::vector<cond_token>& token
             auto combCond = parseCombCond(tokens, pos, token.nxt_pos);
             optionCond->conds.push_back(combCond);
             pos++; // skip RBracket
+        }else if(token.type == cond_token::TokenType::Not){
+            pos++;
+            auto baseCond = parseBaseCond(tokens, pos, pos_end);
+            optionCond->conds.push_back(std::make_shared<NotCond>(baseCond));
         }else{
             auto baseCond = parseBaseCond(tokens, pos, pos_end);
             optionCond->conds.push_back(baseCond);
@@ -127,6 +181,35 @@ std::shared_ptr<OptionCond> parseOptionCond(const std::vector<cond_token>& token
     return optionCond;
 }
 
+// `pingze:` followed by 平 (level), 仄 (oblique) and 中 or # (either), one
+// per character; appends a condition per position to the list.
+bool parseTonePattern(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end, CondList& condList){
+    auto& keyword = tokens[pos];
+    ToneCond::Policy policy;
+    if(keyword.type != cond_token::TokenType::Letters || keyword.value.compare(0, 6, "pingze") != 0)
+        return false;
+    if(pos + 1 >= pos_end || tokens[pos + 1].type != cond_token::TokenType::Colon)
+        return false;
+    if(!parseTonePolicy(keyword.value.substr(6), policy))
+        throw ParseException("invalid tone pattern: " + keyword.value, keyword.original_pos.first, keyword.original_pos.second);
+
+    size_t start = condList.conds.size();
+    for(pos += 2; pos < pos_end; ++pos){
+        auto& token = tokens[pos];
+        if(token.type == cond_token::TokenType::Hash || (token.type == cond_token::TokenType::Char && token.value == "中"))
+            condList.conds.push_back(std::make_shared<WildcardCond>());
+        else if(token.type == cond_token::TokenType::Char && token.value == "平")
+            condList.conds.push_back(std::make_shared<ToneCond>(ToneCond::Level, policy));
+        else if(token.type == cond_token::TokenType::Char && token.value == "仄")
+            condList.conds.push_back(std::make_shared<ToneCond>(ToneCond::Oblique, policy));
+        else
+            break;
+    }
+    if(condList.conds.size() == start)
+        throw ParseException("expected tone pattern after ':'", keyword.original_pos.first, tokens[pos - 1].original_pos.second);
+    return true;
+}
+
 std::shared_ptr<CondList> parseCondList(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end){
     auto condList = std::make_shared<CondList>();
     if(pos >= pos_end){
@@ -138,20 +221,7 @@ std::shared_ptr<CondList> parseCondList(const std::vector<cond_token>& tokens, s
     }
     while(pos < pos_end){
         auto& token = tokens[pos];
-        if(token.type == cond_token::TokenType::LBracket){
-            pos++;
-            auto optionCond = parseOptionCond(tokens, pos, token.nxt_pos);
-            condList->conds.push_back(optionCond);
-            pos++; // skip RBracket
-        }else if(token.type == cond_token::TokenType::Lt){
-            auto unorderedCond = parseCondList(tokens, pos, token.nxt_pos);
-            pos = token.nxt_pos + 1;
-            condList->conds.push_back(unorderedCond);
-        }else if(token.type == cond_token::TokenType::LParen){
-            auto subCondList = parseGlobalExpression(tokens, pos, token.nxt_pos + 1);
-            condList->conds.push_back(subCondList);
-            pos = token.nxt_pos + 1;
-        }else if(token.type == cond_token::TokenType::Asterisk){
+        if(token.type == cond_token::TokenType::Asterisk){
             if(condList->conds.empty())
                 throw ParseException("multi match must follow a condition", pos, pos);
             auto multiCond = std::make_shared<MultiCond>();
@@ -159,14 +229,77 @@ std::shared_ptr<CondList> parseCondList(const std::vector<cond_token>& tokens, s
             condList->conds.pop_back();
             condList->conds.push_back(multiCond);
             pos++;
-        }else{
-            auto baseCond = parseBaseCond(tokens, pos, pos_end);
-            condList->conds.push_back(baseCond);
+        }else if(token.type == cond_token::TokenType::LBrace){
+            if(condList->conds.empty())
+                throw ParseException("repetition must follow a condition", token.original_pos.first, token.original_pos.second);
+            auto multiCond = parseRepetition(tokens, pos, token.nxt_pos);
+            multiCond->conds = condList->conds.back();
+            condList->conds.pop_back();
+            condList->conds.push_back(multiCond);
+            pos = token.nxt_pos + 1;
+        }else if(!parseTonePattern(tokens, pos, pos_end, *condList)){
+            condList->conds.push_back(parseCondListItem(tokens, pos, pos_end));
         }
     }
     return condList;
 }
 
+std::shared_ptr<MultiCond> parseRepetition(const std::vector<cond_token>& tokens, size_t pos, size_t pos_end){
+    auto& brace = tokens[pos];
+    auto multiCond = std::make_shared<MultiCond>();
+    auto expect_number = [&](size_t at) -> size_t {
+        if(at >= pos_end || tokens[at].type != cond_token::TokenType::Number)
+            throw ParseException("expected repetition count", brace.original_pos.first, tokens[pos_end].original_pos.second);
+        return std::stoul(tokens[at].value);
+    };
+
+    pos++;
+    multiCond->min_count = expect_number(pos++);
+    multiCond->max_count = multiCond->min_count;
+    if(pos < pos_end && tokens[pos].type == cond_token::TokenType::Comma){
+        pos++;
+        multiCond->max_count = pos < pos_end ? expect_number(pos++) : cond_matcher::INF_LENGTH;
+    }
+    if(pos != pos_end)
+        throw ParseException("invalid repetition", brace.original_pos.first, tokens[pos_end].original_pos.second);
+    if(multiCond->max_count < multiCond->min_count || multiCond->max_count == 0)
+        throw ParseException("invalid repetition range", brace.original_pos.first, tokens[pos_end].original_pos.second);
+    return multiCond;
+}
+
+cond_ptr parseCondListItem(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end){
+    auto& token = tokens[pos];
+    if(token.type == cond_token::TokenType::LBracket){
+        pos++;
+        auto optionCond = parseOptionCond(tokens, pos, token.nxt_pos);
+        pos++; // skip RBracket
+        return optionCond;
+    }else if(token.type == cond_token::TokenType::Lt){
+        auto unorderedCond = parseCondList(tokens, pos, token.nxt_pos);
+        pos = token.nxt_pos + 1;
+        return unorderedCond;
+    }else if(token.type == cond_token::TokenType::LParen){
+        auto subCondList = parseGlobalExpression(tokens, pos, token.nxt_pos + 1);
+        pos = token.nxt_pos + 1;
+        return subCondList;
+    }else if(token.type == cond_token::TokenType::Not){
+        pos++;
+        if(pos >= pos_end)
+            throw ParseException("expected condition after negation", token.original_pos.first, token.original_pos.second);
+        auto cond = parseCondListItem(tokens, pos, pos_end);
+        switch(cond->type){
+            case Cond::CondType::Base:
+            case Cond::CondType::Comb:
+            case Cond::CondType::Option:
+            case Cond::CondType::Not:
+                return std::make_shared<NotCond>(cond);
+            default:
+                return std::make_shared<NotCondList>(cond);
+        }
+    }
+    return parseBaseCond(tokens, pos, pos_end);
+}
+
 
 std::shared_ptr<CondList> parseGlobalExpression(const std::vector<cond_token>& tokens, size_t& pos, size_t pos_end){
     if(pos >= pos_end)
@@ -238,6 +371,7 @@ void braket_match(std::vector<cond_token>& tokens){
         { cond_token::TokenType::LBracket, cond_token::TokenType::RBracket },
         { cond_token::TokenType::LParen, cond_token::TokenType::RParen  },
         { cond_token::TokenType::Lt, cond_token::TokenType::Gt },
+        { cond_token::TokenType::LBrace, cond_token::TokenType::RBrace },
     };
     while(pos < tokens.size()){
         auto& token = tokens[pos];
@@ -285,8 +419,17 @@ std::vector<cond_token> tokenizeCondString(const std::string& condStr){
         { '?', cond_token::TokenType::QuestionMark},
         { '&', cond_token::TokenType::And },
         { '|', cond_token::TokenType::Or  },
+        { '!', cond_token::TokenType::Not },
+        { '^', cond_token::TokenType::Not },
+        { '{', cond_token::TokenType::LBrace },
+        { '}', cond_token::TokenType::RBrace },
         { '(', cond_token::TokenType::LParen },
         { ')', cond_token::TokenType::RParen  },
+        { '/', cond_token::TokenType::Slash },
+        { ':', cond_token::TokenType::Colon },
+        { ';', cond_token::TokenType::Semicolon },
+        { '%', cond_token::TokenType::Percent },
+        { '~', cond_token::TokenType::Tilde },
     };
 
     auto is_digit = [](uint32_t cp){
@@ -317,6 +460,10 @@ std::vector<cond_token> tokenizeCondString(const std::string& condStr){
                 alphaStr += ReString::codepointToString(nextCp);
             }
             tokens.emplace_back(cond_token::TokenType::Letters, alphaStr, pos_l, pos);
+        }else if((cp == '>' || cp == '<') && readUTF8Char(condStr, pos, false).first == '='){
+            readUTF8Char(condStr, pos);
+            auto type = cp == '>' ? cond_token::TokenType::Ge : cond_token::TokenType::Le;
+            tokens.emplace_back(type, cp == '>' ? ">=" : "<=", pos_l, pos);
         }else if(singleCharTokens.find(cp) != singleCharTokens.end()){
             tokens.emplace_back(singleCharTokens[cp], ReString::codepointToString(cp), pos_l, pos);
         }else if (is_digit(cp)) {
@@ -1,5 +1,7 @@
 #include "database.h"
+#include "parallel.h"
 #include <cstdlib>
+#include <algorithm>
 
 
 size_t PoetryItem::estimateMemoryUsage() const {
@@ -16,6 +18,82 @@ size_t PoetryItem::estimateMemoryUsage() const {
     return total;
 }
 
+void SentenceStore::build(const std::vector<PoetryItem>& items) {
+    buckets.clear();
+    sentence_count = 0;
+    poem_count = items.size();
+    poem_first_line.assign(1, 0);
+    for (const auto& item : items) {
+        poem_first_line.push_back(poem_first_line.back() + item.sentences.size());
+        for (const auto& sentence : item.sentences) {
+            if (sentence.size() >= buckets.size())
+                buckets.resize(sentence.size() + 1);
+            buckets[sentence.size()].poetry_ids.push_back(0);
+        }
+    }
+
+    for (size_t len = 0; len < buckets.size(); ++len) {
+        auto& bucket = buckets[len];
+        auto count = bucket.poetry_ids.size();
+        bucket.length = len;
+        bucket.first_id = sentence_count;
+        bucket.poetry_ids.clear();
+        bucket.poetry_ids.reserve(count);
+        bucket.line_ids.reserve(count);
+        bucket.codes.reserve(count * len);
+        sentence_count += count;
+    }
+
+    for (const auto& item : items) {
+        for (size_t line = 0; line < item.sentences.size(); ++line) {
+            const auto& sentence = item.sentences[line];
+            auto& bucket = buckets[sentence.size()];
+            bucket.codes.insert(bucket.codes.end(), sentence.begin(), sentence.end());
+            bucket.poetry_ids.push_back(static_cast<uint32_t>(item.id));
+            bucket.line_ids.push_back(static_cast<uint32_t>(line));
+        }
+    }
+}
+
+const SentenceBucket& SentenceStore::bucketOf(size_t id) const {
+    auto it = std::upper_bound(buckets.begin(), buckets.end(), id,
+        [](size_t value, const SentenceBucket& bucket) { return value < bucket.first_id; });
+    return *(it - 1);
+}
+
+void CharPostings::build(const SentenceStore& store) {
+    bitmaps.clear();
+    std::vector<uint32_t> last;
+    for (const auto& bucket : store.buckets) {
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            auto id = static_cast<uint32_t>(bucket.first_id + i);
+            const uint16_t* str = bucket.sentence(i);
+            for (size_t p = 0; p < bucket.length; ++p) {
+                uint16_t code = str[p];
+                if (code >= bitmaps.size()) {
+                    bitmaps.resize(code + 1);
+                    last.resize(code + 1, UINT32_MAX);
+                }
+                if (last[code] == id) continue;
+                last[code] = id;
+                bitmaps[code].push_back(id);
+            }
+        }
+    }
+}
+
+size_t SentenceStore::estimateMemoryUsage() const {
+    size_t total = sizeof(SentenceStore);
+    total += buckets.capacity() * sizeof(SentenceBucket);
+    for (const auto& bucket : buckets) {
+        total += bucket.codes.capacity() * sizeof(uint16_t);
+        total += bucket.poetry_ids.capacity() * sizeof(uint32_t);
+        total += bucket.line_ids.capacity() * sizeof(uint32_t);
+    }
+    total += poem_first_line.capacity() * sizeof(size_t);
+    return total;
+}
+
 int PoetryDatabase::loadFromCSV(const std::string& filename) {
     FILE* file = std::fopen(filename.c_str(), "r");
 
@@ -51,8 +129,9 @@ int PoetryDatabase::loadFromCSV(const std::string& filename) {
 
             if (!line_buf.empty()) {
                 std::string title, dynasty, author, content;
-                if (parseCSVLine(line_buf, title, dynasty, author, content)) {
-                    insertItem(title, dynasty, author, content);
+                double popularity;
+                if (parseCSVLine(line_buf, title, dynasty, author, content, popularity)) {
+                    insertItem(title, dynasty, author, content, popularity);
                     line_cnt++;
                 }
             }
@@ -63,12 +142,28 @@ int PoetryDatabase::loadFromCSV(const std::string& filename) {
 
     if (!line_buf.empty() && line_cnt > 0) {
         std::string title, dynasty, author, content;
-        if (parseCSVLine(line_buf, title, dynasty, author, content)) {
-            insertItem(title, dynasty, author, content);
+        double popularity;
+        if (parseCSVLine(line_buf, title, dynasty, author, content, popularity)) {
+            insertItem(title, dynasty, author, content, popularity);
             line_cnt++;
         }
     }
 
+    std::fclose(file);
+    sentence_store_.build(poetry_items_);
+    ReString::code_frequency.assign(ReString::char_map.size(), 0);
+    parallel_for(2, [this](size_t task, size_t) {
+        if (task == 0) {
+            char_postings_.build(sentence_store_);
+            return;
+        }
+        for (const auto& bucket : sentence_store_.buckets) {
+            for (auto code : bucket.codes) {
+                if (code < ReString::code_frequency.size()) ReString::code_frequency[code]++;
+            }
+        }
+    });
+
     return line_cnt <= 1 ? 0 : line_cnt - 1; // exclude header
 }
 
@@ -76,6 +171,14 @@ const std::vector<PoetryItem>& PoetryDatabase::getAllPoetry() const {
     return poetry_items_;
 }
 
+const SentenceStore& PoetryDatabase::getSentenceStore() const {
+    return sentence_store_;
+}
+
+const CharPostings& PoetryDatabase::getCharPostings() const {
+    return char_postings_;
+}
+
 size_t PoetryDatabase::estimateMemoryUsage() const {
     size_t total = 0;
 
@@ -85,6 +188,8 @@ size_t PoetryDatabase::estimateMemoryUsage() const {
     for (const auto& item : poetry_items_) {
         total += item.estimateMemoryUsage();
     }
+    total += sentence_store_.estimateMemoryUsage();
+    total += char_postings_.estimate_memory_usage();
 
     return total;
 }
@@ -97,7 +202,8 @@ bool PoetryDatabase::parseCSVLine(std::string& line,
                  std::string& title, 
                  std::string& dynasty, 
                  std::string& author, 
-                 std::string& content) {
+                 std::string& content,
+                 double& popularity) {
     std::string field;
     std::vector<std::string> fields;
     for(char c: line){
@@ -116,6 +222,7 @@ bool PoetryDatabase::parseCSVLine(std::string& line,
     dynasty = trimQuotes(fields[1]);
     author = trimQuotes(fields[2]);
     content = trimQuotes(fields[3]);
+    popularity = fields.size() > 4 ? std::strtod(trimQuotes(fields[4]).c_str(), nullptr) : 0;
 
     return true;
 }
@@ -0,0 +1,167 @@
+#include "index.h"
+#include "parallel.h"
+#include <algorithm>
+
+void PositionalIndex::build(const SentenceStore& store) {
+    size_t max_len = std::min(store.maxLength(), MAX_INDEXED_LENGTH);
+    slots_.assign(max_len + 1, {});
+    std::vector<std::vector<uint8_t>> local(max_len + 1);
+
+    parallel_for(max_len, [&](size_t k, size_t) {
+        int len = static_cast<int>(k) + 1;
+        const auto& bucket = store.buckets[len];
+        auto& out = local[len];
+        slots_[len].resize(len);
+
+        std::vector<uint64_t> keys(bucket.size());
+        for (int pos = 0; pos < len; ++pos) {
+            for (size_t i = 0; i < bucket.size(); ++i) {
+                keys[i] = (static_cast<uint64_t>(bucket.sentence(i)[pos]) << 32) | i;
+            }
+            std::sort(keys.begin(), keys.end());
+
+            auto& slot = slots_[len][pos];
+            for (size_t k = 0; k < keys.size();) {
+                uint16_t code = static_cast<uint16_t>(keys[k] >> 32);
+                uint32_t prev = 0, count = 0;
+                slot.codes.push_back(code);
+                slot.offsets.push_back(static_cast<uint32_t>(out.size()));
+                for (; k < keys.size() && (keys[k] >> 32) == code; ++k) {
+                    uint32_t id = static_cast<uint32_t>(keys[k]);
+                    appendVarint(out, id - prev);
+                    prev = id;
+                    count++;
+                }
+                slot.counts.push_back(count);
+            }
+        }
+    });
+
+    data_.clear();
+    for (size_t len = 1; len <= max_len; ++len) {
+        auto base = static_cast<uint32_t>(data_.size());
+        data_.insert(data_.end(), local[len].begin(), local[len].end());
+        for (auto& slot : slots_[len]) {
+            for (auto& offset : slot.offsets) offset += base;
+        }
+    }
+}
+
+PostingView PositionalIndex::find(size_t length, size_t pos, uint16_t code) const {
+    if (!covers(length) || pos >= slots_[length].size()) return {};
+    const auto& slot = slots_[length][pos];
+    auto it = std::lower_bound(slot.codes.begin(), slot.codes.end(), code);
+    if (it == slot.codes.end() || *it != code) return {};
+    auto k = it - slot.codes.begin();
+    return { data_.data() + slot.offsets[k], slot.counts[k] };
+}
+
+bool PositionalIndex::candidates(size_t length, const std::vector<Anchor>& anchors, std::vector<uint32_t>& ids, size_t max_lists) const {
+    if (!covers(length) || anchors.empty()) return false;
+
+    std::vector<PostingView> lists;
+    for (const auto& anchor : anchors) {
+        lists.push_back(find(length, anchor.pos, anchor.code));
+    }
+    std::sort(lists.begin(), lists.end(), [](const PostingView& a, const PostingView& b) {
+        return a.count < b.count;
+    });
+    if (lists.size() > max_lists) lists.resize(max_lists);
+
+    ids = lists[0].decode();
+    for (size_t i = 1; i < lists.size() && !ids.empty(); ++i) {
+        lists[i].intersect(ids);
+    }
+    return true;
+}
+
+size_t PositionalIndex::estimateMemoryUsage() const {
+    size_t total = sizeof(PositionalIndex) + data_.capacity();
+    for (const auto& row : slots_) {
+        total += row.capacity() * sizeof(Slot);
+        for (const auto& slot : row) {
+            total += slot.codes.capacity() * sizeof(uint16_t);
+            total += slot.offsets.capacity() * sizeof(uint32_t);
+            total += slot.counts.capacity() * sizeof(uint32_t);
+        }
+    }
+    return total;
+}
+
+void NgramIndex::build(const SentenceStore& store) {
+    // Pairs are bucketed by their first code so each bucket sorts separately.
+    const size_t alphabet = 1 << 16;
+    std::vector<size_t> start(alphabet + 1, 0);
+    for (const auto& bucket : store.buckets) {
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            const uint16_t* str = bucket.sentence(i);
+            for (size_t p = 0; p + 1 < bucket.length; ++p) start[str[p] + 1]++;
+        }
+    }
+    for (size_t c = 0; c < alphabet; ++c) start[c + 1] += start[c];
+
+    std::vector<uint64_t> pairs(start[alphabet]);
+    std::vector<size_t> fill(start.begin(), start.end() - 1);
+    for (const auto& bucket : store.buckets) {
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            const uint16_t* str = bucket.sentence(i);
+            uint64_t id = bucket.first_id + i;
+            for (size_t p = 0; p + 1 < bucket.length; ++p) {
+                pairs[fill[str[p]]++] = (static_cast<uint64_t>(str[p + 1]) << 32) | id;
+            }
+        }
+    }
+
+    parallel_for(alphabet, [&](size_t c, size_t) {
+        std::sort(pairs.begin() + start[c], pairs.begin() + start[c + 1]);
+    });
+
+    keys_.clear();
+    offsets_.clear();
+    counts_.clear();
+    data_.clear();
+    for (size_t c = 0; c < alphabet; ++c) {
+        for (size_t k = start[c]; k < start[c + 1];) {
+            uint16_t second = static_cast<uint16_t>(pairs[k] >> 32);
+            uint32_t prev = 0, count = 0;
+            keys_.push_back(key(static_cast<uint16_t>(c), second));
+            offsets_.push_back(static_cast<uint32_t>(data_.size()));
+            for (; k < start[c + 1] && (pairs[k] >> 32) == second; ++k) {
+                uint32_t id = static_cast<uint32_t>(pairs[k]);
+                if (count > 0 && id == prev) continue;
+                appendVarint(data_, id - prev);
+                prev = id;
+                count++;
+            }
+            counts_.push_back(count);
+        }
+    }
+}
+
+PostingView NgramIndex::find(uint16_t first, uint16_t second) const {
+    auto it = std::lower_bound(keys_.begin(), keys_.end(), key(first, second));
+    if (it == keys_.end() || *it != key(first, second)) return {};
+    auto k = it - keys_.begin();
+    return { data_.data() + offsets_[k], counts_[k] };
+}
+
+std::vector<uint32_t> NgramIndex::candidates(const ReString& needle) const {
+    std::vector<PostingView> lists;
+    for (size_t p = 0; p + 1 < needle.size(); ++p) {
+        lists.push_back(find(needle[p], needle[p + 1]));
+    }
+    std::sort(lists.begin(), lists.end(), [](const PostingView& a, const PostingView& b) {
+        return a.count < b.count;
+    });
+
+    auto ids = lists[0].decode();
+    for (size_t i = 1; i < lists.size() && !ids.empty(); ++i) {
+        lists[i].intersect(ids);
+    }
+    return ids;
+}
+
+size_t NgramIndex::estimateMemoryUsage() const {
+    return sizeof(NgramIndex) + data_.capacity() +
+        (keys_.capacity() + offsets_.capacity() + counts_.capacity()) * sizeof(uint32_t);
+}
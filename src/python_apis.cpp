@@ -1,11 +1,15 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/functional.h>
+#include <optional>
 #include <ctime>
+#include <chrono>
 
 #include "database.h"
 #include "cond_parser.h"
 #include "executor.h"
+#include "query.h"
+#include "rank.h"
 
 
 namespace py = pybind11;
@@ -86,9 +90,14 @@ struct PyPoetryItem {
 struct PyQueryResult {
     std::vector<QueryResult> res;
     PoetryDatabase* db;
+    ExecuteStats stats;
+    size_t width;
+    size_t cursor = 0;
+    size_t offset = 0;
+    bool more = false;
 
-    PyQueryResult(std::vector<QueryResult> res, PoetryDatabase* db)
-        : res(res), db(db) {}
+    PyQueryResult(std::vector<QueryResult> res, PoetryDatabase* db, ExecuteStats stats = {}, size_t width = 1)
+        : res(res), db(db), stats(stats), width(width) {}
 
     PyPoetryItem get(size_t index) const {
         return db->getPoetryById(res.at(index).poetry_id);
@@ -98,10 +107,37 @@ struct PyQueryResult {
         return {res.at(index).poetry_id, res.at(index).match_positions};
     }
 
+    double get_score(size_t index) const {
+        return res.at(index).score;
+    }
+
     size_t size() const {
         return res.size();
     }
 
+    size_t scanned() const {
+        return stats.scanned;
+    }
+
+    size_t pruned() const {
+        return stats.pruned;
+    }
+
+    std::vector<double> busy() const {
+        return stats.busy.ms;
+    }
+
+    bool truncated() const {
+        return stats.truncated;
+    }
+
+    PyQueryResult& with_page(const Page& page) {
+        cursor = page.next;
+        offset = page.skip;
+        more = page.more;
+        return *this;
+    }
+
     std::string toString(){
         return show(5);
     }
@@ -111,7 +147,11 @@ struct PyQueryResult {
         std::string result;
         for(size_t i = 0; i < lim; i++){
             auto& item = db->getPoetryById(res.at(i).poetry_id);
-            result += item.sentences[res.at(i).match_positions[0]].toString();
+            auto& positions = res.at(i).match_positions;
+            auto first = positions.empty() ? 0 : positions[0];
+            for(size_t k = 0; k < width && first + k < item.sentences.size(); k++){
+                result += (k > 0 ? " / " : "") + item.sentences[first + k].toString();
+            }
             result += "<<" + item.title + ">>";
             result += " [" + item.dynasty + "] " + item.author;
             result += "\n";
@@ -120,13 +160,173 @@ struct PyQueryResult {
     }
 };
 
+// Result of a query running on a database's pool. It can be waited for
+// from any thread or awaited from asyncio; neither holds the GIL while the
+// query runs.
+struct PyQueryFuture {
+    struct State {
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done = false;
+        std::unique_ptr<PyQueryResult> result;
+        std::exception_ptr error;
+        // Event loops and their asyncio futures awaiting the result.
+        std::vector<std::pair<py::object, py::object>> waiters;
+        // Stops the query; derived from the caller's token, kept alive here.
+        std::shared_ptr<CancelToken> token, parent;
+    };
+
+    std::shared_ptr<State> state = std::make_shared<State>();
+
+    // Called on the thread that ran the query, without the GIL.
+    void finish(std::unique_ptr<PyQueryResult> result, std::exception_ptr error) {
+        std::vector<std::pair<py::object, py::object>> waiters;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->result = std::move(result);
+            state->error = error;
+            state->done = true;
+            waiters.swap(state->waiters);
+        }
+        state->finished.notify_all();
+        if (waiters.empty()) {
+            return;
+        }
+        py::gil_scoped_acquire gil;
+        for (auto& [loop, future] : waiters) {
+            auto state = this->state;
+            auto target = future;
+            try {
+                loop.attr("call_soon_threadsafe")(py::cpp_function([state, target] { settle(*state, target); }));
+            } catch (py::error_already_set&) {
+                // The loop was closed before the query finished.
+            }
+        }
+        waiters.clear();
+    }
+
+    // Completes an asyncio future with the outcome, on its loop's thread.
+    static void settle(const State& state, py::object future) {
+        if (future.attr("done")().cast<bool>()) {
+            return;
+        }
+        if (!state.error) {
+            future.attr("set_result")(*state.result);
+            return;
+        }
+        try {
+            std::rethrow_exception(state.error);
+        } catch (const std::exception& e) {
+            future.attr("set_exception")(py::module_::import("builtins").attr("RuntimeError")(e.what()));
+        }
+    }
+
+    bool done() const {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->done;
+    }
+
+    // Stops the query at its next chunk; it still completes, with the
+    // results found so far.
+    void cancel() {
+        state->token->cancel();
+    }
+
+    PyQueryResult result(std::optional<double> timeout) {
+        bool finished;
+        {
+            py::gil_scoped_release release;
+            std::unique_lock<std::mutex> lock(state->mutex);
+            auto ready = [this] { return state->done; };
+            if (timeout) {
+                finished = state->finished.wait_for(lock, std::chrono::duration<double>(*timeout), ready);
+            } else {
+                state->finished.wait(lock, ready);
+                finished = true;
+            }
+        }
+        if (!finished) {
+            PyErr_SetString(PyExc_TimeoutError, "query is still running");
+            throw py::error_already_set();
+        }
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+        return *state->result;
+    }
+
+    py::object await() {
+        auto loop = py::module_::import("asyncio").attr("get_running_loop")();
+        auto future = loop.attr("create_future")();
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (!state->done) {
+                state->waiters.emplace_back(loop, future);
+                return future.attr("__await__")();
+            }
+        }
+        settle(*state, future);
+        return future.attr("__await__")();
+    }
+};
+
 class Database {
 private:
     PoetryDatabase db_;
+    PositionalIndex index_;
+    NgramIndex ngram_index_;
+    ThreadPool pool_;
+    bool openmp_ = false;
+
+    // Makes the parallel work of the calling method run on this database's
+    // pool, or on OpenMP when that backend was chosen.
+    ThreadPool::Scope threads() {
+        return ThreadPool::Scope(openmp_ ? nullptr : &pool_);
+    }
 
 public:
+    // Queued match_async tasks still run and finish() takes the GIL to
+    // wake their event loops, so the workers are joined without it.
+    ~Database() {
+        std::optional<py::gil_scoped_release> release;
+        if (PyGILState_Check()) {
+            release.emplace();
+        }
+        pool_.stop();
+    }
+
+    // Refused while queries run on the pool.
+    void set_threads(size_t n, bool pin) {
+        pool_.resize(n, pin);
+        if (pin && !pool_.pinned()) {
+            std::cout << "Thread pinning is not supported on this platform." << std::endl;
+        }
+    }
+
+    size_t get_threads() {
+        auto use = threads();
+        return max_threads();
+    }
+
+    void set_backend(const std::string& backend) {
+        if (backend == "pool") {
+            openmp_ = false;
+        } else if (backend == "openmp") {
+#ifdef _OPENMP
+            openmp_ = true;
+#else
+            throw std::runtime_error("this build does not support OpenMP");
+#endif
+        } else {
+            throw std::runtime_error("unknown backend: " + backend + " (expected pool or openmp)");
+        }
+    }
+
     bool load(const std::string& filename) {
+        auto use = threads();
         int tim = clock();
+        index_ = PositionalIndex();
+        ngram_index_ = NgramIndex();
         auto res = db_.loadFromCSV(filename);
         tim = clock() - tim;
         if(res > 0){
@@ -149,6 +349,16 @@ public:
         return res;
     }
 
+    void build_index() {
+        auto use = threads();
+        int tim = clock();
+        index_.build(db_.getSentenceStore());
+        ngram_index_.build(db_.getSentenceStore());
+        tim = clock() - tim;
+        std::cout << "Built positional index (" << index_.estimateMemoryUsage() / 1024 << " KB) and bigram index ("
+                  << ngram_index_.estimateMemoryUsage() / 1024 << " KB) in " << (tim / 1000.0) << " seconds." << std::endl;
+    }
+
     PyPoetryItem get_poetry_by_id(size_t id) const {
         auto& item = db_.getPoetryById(id);
         
@@ -164,21 +374,234 @@ public:
     }
 
     size_t get_memory_usage() {
-        return ReString::estimateMapMemoryUse() + db_.estimateMemoryUsage();
+        return ReString::estimateMapMemoryUse() + db_.estimateMemoryUsage() + index_.estimateMemoryUsage() + ngram_index_.estimateMemoryUsage();
     }
 
-    PyQueryResult match(const std::string& query) {
-        auto cond = parseCond(query);
-        if(!cond){
-            throw std::runtime_error("Failed to parse query string");
+    // Stops at the next chunk once timeout_ms (0 for none) passes or the
+    // token is cancelled, returning what was found with truncated set.
+    PyQueryResult match(const std::string& query, size_t limit, size_t offset, size_t cursor, size_t timeout_ms, std::shared_ptr<CancelToken> token) {
+        auto use = threads();
+        CancelToken cancel(token.get(), timeout_ms);
+        auto poem_query = parsePoemQuery(query);
+        Page page;
+        page.start = cursor;
+        page.offset = offset;
+        page.limit = limit;
+        if(poem_query.scoped()){
+            return match_poems(poem_query, page, &cancel);
+        }
+        auto& window = poem_query.clauses[0].window;
+        if(window.size() > 1){
+            return match_window(window, page, &cancel);
         }
-        auto matcher = cond->compile();
+        auto program = MatchProgram::lower(window.lines[0]->compile());
         int tim = clock();
         Executor<ExecuteStrategy::Parallel> executor;
-        auto results = executor.execute(matcher, db_.getAllPoetry());
+        executor.page = page;
+        // Without a timeout or token nothing can stop the scan, which then
+        // takes the faster route that is not in poem order.
+        executor.cancel = timeout_ms || token ? &cancel : nullptr;
+        auto results = executor.execute(program, db_.getSentenceStore(), &db_.getCharPostings(), index_.empty() ? nullptr : &index_);
         tim = clock() - tim;
-        std::cout << "Found " << results.size() << " results in " << (tim / 1000.0) << " seconds." << std::endl;
-        return PyQueryResult(results, &db_);
+        std::cout << "Found " << results.size() << " results in " << (tim / 1000.0) << " seconds";
+        if(executor.stats.pruned > 0){
+            std::cout << " (" << executor.stats.pruned << " sentences pruned)";
+        }
+        if(executor.stats.truncated){
+            std::cout << " (stopped early)";
+        }
+        std::cout << "." << std::endl;
+        return PyQueryResult(results, &db_, executor.stats).with_page(executor.page);
+    }
+
+    // Queues the query on the pool and returns at once; the timeout counts
+    // from this call. The database must not be reloaded or re-indexed
+    // while queries are in flight.
+    PyQueryFuture match_async(const std::string& query, size_t limit, size_t offset, size_t cursor, size_t timeout_ms, std::shared_ptr<CancelToken> token) {
+        PyQueryFuture future;
+        future.state->parent = token;
+        future.state->token = std::make_shared<CancelToken>(token.get(), timeout_ms);
+        // The future completes only once the task has left the pool, so a
+        // caller woken by it may call set_threads.
+        auto result = std::make_shared<std::unique_ptr<PyQueryResult>>();
+        auto error = std::make_shared<std::exception_ptr>();
+        pool_.submit([this, future, result, error, query, limit, offset, cursor] {
+            try {
+                *result = std::make_unique<PyQueryResult>(match(query, limit, offset, cursor, 0, future.state->token));
+            } catch (...) {
+                *error = std::current_exception();
+            }
+        }, [future, result, error]() mutable {
+            future.finish(std::move(*result), *error);
+        });
+        return future;
+    }
+
+    // Runs every single-line query in one shared pass over the corpus;
+    // windows and poem queries are matched one by one.
+    std::vector<PyQueryResult> match_many(const std::vector<std::string>& queries, size_t timeout_ms, std::shared_ptr<CancelToken> token) {
+        auto use = threads();
+        CancelToken cancel(token.get(), timeout_ms);
+        std::vector<PoemQuery> parsed;
+        std::vector<MatchProgram> programs;
+        std::vector<size_t> batched;
+        for(size_t i = 0; i < queries.size(); ++i){
+            parsed.push_back(parsePoemQuery(queries[i]));
+            auto& window = parsed.back().clauses[0].window;
+            if(!parsed.back().scoped() && window.size() == 1){
+                programs.push_back(MatchProgram::lower(window.lines[0]->compile()));
+                batched.push_back(i);
+            }
+        }
+
+        std::vector<PyQueryResult> results(queries.size(), PyQueryResult(std::vector<QueryResult>(), &db_));
+        int tim = clock();
+        BatchExecutor executor;
+        executor.cancel = timeout_ms || token ? &cancel : nullptr;
+        auto found = executor.execute(programs, db_.getSentenceStore(), &db_.getCharPostings(), index_.empty() ? nullptr : &index_);
+        size_t total = 0;
+        for(size_t k = 0; k < batched.size(); ++k){
+            total += found[k].size();
+            results[batched[k]] = PyQueryResult(std::move(found[k]), &db_, executor.stats[k]);
+        }
+        tim = clock() - tim;
+        std::cout << "Found " << total << " results for " << batched.size() << " queries in " << (tim / 1000.0) << " seconds"
+                  << (cancel.stopped() ? " (stopped early)." : ".") << std::endl;
+
+        for(size_t i = 0, k = 0; i < queries.size(); ++i){
+            if(k < batched.size() && batched[k] == i){
+                ++k;
+                continue;
+            }
+            auto& window = parsed[i].clauses[0].window;
+            results[i] = parsed[i].scoped() ? match_poems(parsed[i], Page(), &cancel) : match_window(window, Page(), &cancel);
+        }
+        return results;
+    }
+
+    PyQueryResult match_window(const LineWindow& window, const Page& page, const CancelToken* cancel) {
+        std::vector<MatchProgram> programs;
+        for(auto& line : window.lines){
+            programs.push_back(MatchProgram::lower(line->compile()));
+        }
+        int tim = clock();
+        WindowExecutor executor;
+        executor.page = page;
+        executor.cancel = cancel;
+        auto results = executor.execute(programs, db_.getAllPoetry(), db_.getSentenceStore());
+        tim = clock() - tim;
+        std::cout << "Found " << results.size() << " results in " << (tim / 1000.0) << " seconds"
+                  << (executor.stats.truncated ? " (stopped early)." : ".") << std::endl;
+        return PyQueryResult(results, &db_, executor.stats, window.size()).with_page(executor.page);
+    }
+
+    PyQueryResult match_poems(const PoemQuery& query, const Page& page, const CancelToken* cancel) {
+        std::vector<std::vector<MatchProgram>> programs;
+        for(auto& clause : query.clauses){
+            programs.emplace_back();
+            for(auto& line : clause.window.lines){
+                programs.back().push_back(MatchProgram::lower(line->compile()));
+            }
+        }
+        int tim = clock();
+        PoemExecutor executor;
+        executor.page = page;
+        executor.cancel = cancel;
+        auto results = executor.execute(query, programs, db_.getAllPoetry(), db_.getSentenceStore());
+        tim = clock() - tim;
+        std::cout << "Found " << results.size() << " poems in " << (tim / 1000.0) << " seconds"
+                  << (executor.stats.truncated ? " (stopped early)." : ".") << std::endl;
+        return PyQueryResult(results, &db_, executor.stats, std::max<size_t>(1, query.clauses[0].window.size())).with_page(executor.page);
+    }
+
+    PyQueryResult rank(const std::string& query, size_t k, const std::string& by, size_t timeout_ms, std::shared_ptr<CancelToken> token) {
+        auto use = threads();
+        ScoreFunction score;
+        if(by == "frequency"){
+            score = frequency_score;
+        }else if(by == "length"){
+            score = length_score;
+        }else if(by == "popularity"){
+            score = popularity_score;
+        }else if(by == "author"){
+            score = AuthorScore(db_.getAllPoetry());
+        }else{
+            throw std::runtime_error("unknown ranking: " + by + " (expected frequency, length, popularity or author)");
+        }
+        auto matched = match(query, 0, 0, 0, timeout_ms, token);
+        int tim = clock();
+        matched.res = top_k(std::move(matched.res), k, db_.getAllPoetry(), score);
+        tim = clock() - tim;
+        std::cout << "Ranked top " << matched.res.size() << " by " << by << " in " << (tim / 1000.0) << " seconds." << std::endl;
+        return matched;
+    }
+
+    PyQueryResult fuzzy(const std::string& text, int k, size_t timeout_ms, std::shared_ptr<CancelToken> token) {
+        auto use = threads();
+        CancelToken cancel(token.get(), timeout_ms);
+        if(k < 0){
+            throw std::runtime_error("edit distance must not be negative");
+        }
+        ReString pattern(text, false);
+        int tim = clock();
+        ApproximateExecutor executor;
+        executor.cancel = &cancel;
+        auto results = executor.execute(pattern, k, db_.getSentenceStore(), db_.getCharPostings(), ngram_index_.empty() ? nullptr : &ngram_index_);
+        tim = clock() - tim;
+        std::cout << "Found " << results.size() << " results in " << (tim / 1000.0) << " seconds";
+        if(executor.stats.pruned > 0){
+            std::cout << " (" << executor.stats.pruned << " sentences pruned)";
+        }
+        if(executor.stats.truncated){
+            std::cout << " (stopped early)";
+        }
+        std::cout << "." << std::endl;
+        return PyQueryResult(results, &db_, executor.stats);
+    }
+
+    PyQueryResult contains(const std::string& text, size_t timeout_ms, std::shared_ptr<CancelToken> token) {
+        auto use = threads();
+        CancelToken cancel(token.get(), timeout_ms);
+        ReString needle(text, false);
+        int tim = clock();
+        SubstringExecutor executor;
+        executor.cancel = &cancel;
+        auto results = executor.execute(needle, db_.getSentenceStore(), ngram_index_.empty() ? nullptr : &ngram_index_);
+        tim = clock() - tim;
+        std::cout << "Found " << results.size() << " results in " << (tim / 1000.0) << " seconds";
+        if(executor.stats.pruned > 0){
+            std::cout << " (" << executor.stats.pruned << " sentences pruned)";
+        }
+        if(executor.stats.truncated){
+            std::cout << " (stopped early)";
+        }
+        std::cout << "." << std::endl;
+        return PyQueryResult(results, &db_, executor.stats);
+    }
+
+    // Times the query on one thread with and without the specialized
+    // kernels. Returns the seconds per run of each path.
+    std::pair<double, double> benchmark(const std::string& query, int rounds) {
+        auto cond = parseCond(query);
+        if(!cond){
+            throw std::runtime_error("Failed to parse query string");
+        }
+        auto program = MatchProgram::lower(cond->compile());
+        auto run = [&](bool use_kernels) {
+            Executor<ExecuteStrategy::Sequential> executor;
+            executor.use_kernels = use_kernels;
+            auto start = std::chrono::steady_clock::now();
+            for(int i = 0; i < rounds; ++i){
+                executor.execute(program, db_.getSentenceStore());
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return elapsed.count() / std::max(rounds, 1);
+        };
+        double generic = run(false);
+        double kernel = run(true);
+        std::cout << (program.kernel_leaves.empty() ? "No specialized kernel for this query" : "Static kernel of length " + std::to_string(program.kernel_leaves.size()))
+                  << ": generic " << generic * 1000 << " ms, kernel " << kernel * 1000 << " ms per run." << std::endl;
+        return {generic, kernel};
     }
 
     static size_t get_mapped_char_count() {
@@ -195,17 +618,25 @@ public:
     }
 
     static std::string parse_cond(const std::string& cond_str) {
-        auto cond = parseCond(cond_str);
-        if(cond){
-            // return cond->toString();
-            auto mather = cond->compile();
-            return mather.to_string();
+        auto query = parsePoemQuery(cond_str);
+        std::string result;
+        if(query.scoped()){
+            result += query.toString() + "\n";
         }
-        return "Invalid condition";
-    }
-
-    static void test() {
-        
+        for(size_t c = 0; c < query.clauses.size(); ++c){
+            auto& window = query.clauses[c].window;
+            for(size_t i = 0; i < window.size(); ++i){
+                if(query.scoped()){
+                    result += "clause " + std::to_string(c) + " ";
+                }
+                if(query.scoped() || window.size() > 1){
+                    result += "line " + std::to_string(i) + ":\n";
+                }
+                auto mather = window.lines[i]->compile();
+                result += mather.to_string() + "\n" + MatchProgram::lower(mather).to_string();
+            }
+        }
+        return result;
     }
 };
 
@@ -237,10 +668,26 @@ PYBIND11_MODULE(poetry_search, m) {
     py::class_<PyQueryResult>(m, "QueryResult")
         .def("get_poetry", &PyQueryResult::get_matched_info,
              "Get poetry details by ID", py::arg("id"))
+        .def("get_score", &PyQueryResult::get_score,
+             "Get the ranking score of a result, such as its edit distance", py::arg("index"))
         .def("show", &PyQueryResult::show,
              "Show the query result in the console", py::arg("lim")=100)
         .def("__len__", &PyQueryResult::size,
              "Get the number of results")
+        .def_property_readonly("scanned", &PyQueryResult::scanned,
+             "Number of sentences the matcher ran on")
+        .def_property_readonly("pruned", &PyQueryResult::pruned,
+             "Number of sentences skipped by the index")
+        .def_property_readonly("busy", &PyQueryResult::busy,
+             "Milliseconds each thread spent scanning, to check the load balance")
+        .def_property_readonly("truncated", &PyQueryResult::truncated,
+             "Whether a timeout or cancel token stopped the query before it covered the corpus")
+        .def_readonly("cursor", &PyQueryResult::cursor,
+             "Poem id the next page starts from, to pass as match(cursor=...)")
+        .def_readonly("offset", &PyQueryResult::offset,
+             "Part of the offset a truncated page did not skip yet, to pass with the cursor")
+        .def_readonly("has_more", &PyQueryResult::more,
+             "Whether another page of results follows")
         .def("__getitem__", &PyQueryResult::get,
              "Get poetry details by index", py::arg("index"))
         .def("__str__", &PyQueryResult::toString,
@@ -248,6 +695,23 @@ PYBIND11_MODULE(poetry_search, m) {
         .def("__repr__", &PyQueryResult::toString,
              "Get string representation of the query result");
 
+    py::class_<CancelToken, std::shared_ptr<CancelToken>>(m, "CancelToken")
+        .def(py::init<>())
+        .def("cancel", &CancelToken::cancel,
+             "Stop every query given this token at its next chunk of work")
+        .def_property_readonly("cancelled", &CancelToken::stopped,
+             "Whether the token has been cancelled");
+
+    py::class_<PyQueryFuture>(m, "QueryFuture")
+        .def("done", &PyQueryFuture::done,
+             "Whether the query has finished")
+        .def("cancel", &PyQueryFuture::cancel,
+             "Stop the query early; it completes with the results found so far")
+        .def("result", &PyQueryFuture::result,
+             "Wait for the query and return its result, or raise TimeoutError after timeout seconds",
+             py::arg("timeout")=py::none())
+        .def("__await__", &PyQueryFuture::await);
+
     py::class_<Database>(m, "Database")
         .def(py::init<>())
         .def("load", &Database::load, "Load poetry data from CSV file",
@@ -256,14 +720,53 @@ PYBIND11_MODULE(poetry_search, m) {
              "Load hanzi information from JSON file",
              py::arg("filename"))
 
+        .def("build_index", &Database::build_index,
+             "Build the positional and bigram indexes used to prune queries")
+
+        .def("set_threads", &Database::set_threads,
+             "Resize the worker pool to n threads (0 for every hardware thread), optionally pinning each to a CPU; not while queries run",
+             py::arg("n"), py::arg("pin")=false, py::call_guard<py::gil_scoped_release>())
+        .def("get_threads", &Database::get_threads,
+             "Get the number of threads queries run on")
+        .def("set_backend", &Database::set_backend,
+             "Run parallel work on the worker pool (\"pool\") or on OpenMP (\"openmp\")",
+             py::arg("backend"))
+
         .def("get_poetry", &Database::get_poetry_by_id,
              "Get poetry details by ID", py::arg("id"))
         
         
         
         .def("match", &Database::match,
-             "Find sentences matching specified conditions",
-             py::arg("query"))
+             "Find sentences matching specified conditions, at most limit poems (0 for all) after skipping offset from the cursor",
+             py::arg("query"), py::arg("limit")=0, py::arg("offset")=0, py::arg("cursor")=0,
+             py::arg("timeout_ms")=0, py::arg("token")=py::none(),
+             py::call_guard<py::gil_scoped_release>())
+        .def("match_async", &Database::match_async,
+             "Start matching on the worker pool and return a QueryFuture to wait for or await",
+             py::arg("query"), py::arg("limit")=0, py::arg("offset")=0, py::arg("cursor")=0,
+             py::arg("timeout_ms")=0, py::arg("token")=py::none(),
+             py::call_guard<py::gil_scoped_release>(), py::keep_alive<0, 1>())
+        .def("match_many", &Database::match_many,
+             "Match many queries in one pass over the corpus, returning one result per query",
+             py::arg("queries"), py::arg("timeout_ms")=0, py::arg("token")=py::none(),
+             py::call_guard<py::gil_scoped_release>())
+        .def("rank", &Database::rank,
+             "Find the k best matches by frequency, length, popularity or author",
+             py::arg("query"), py::arg("k")=20, py::arg("by")="frequency",
+             py::arg("timeout_ms")=0, py::arg("token")=py::none(),
+             py::call_guard<py::gil_scoped_release>())
+        .def("benchmark", &Database::benchmark,
+             "Compare the specialized kernels with the generic matcher on a query",
+             py::arg("query"), py::arg("rounds")=10)
+        .def("fuzzy", &Database::fuzzy,
+             "Find lines within k edits of the text, closest first",
+             py::arg("text"), py::arg("k")=1, py::arg("timeout_ms")=0, py::arg("token")=py::none(),
+             py::call_guard<py::gil_scoped_release>())
+        .def("contains", &Database::contains,
+             "Find sentences containing the text anywhere",
+             py::arg("text"), py::arg("timeout_ms")=0, py::arg("token")=py::none(),
+             py::call_guard<py::gil_scoped_release>())
 
         .def("get_poetry_count", &Database::get_poetry_count,
              "Get total number of poetry items")
@@ -277,8 +780,6 @@ PYBIND11_MODULE(poetry_search, m) {
         .def("__getitem__", &Database::get_poetry_by_id,
              "Get poetry details by ID", py::arg("id"))
     
-        .def_static("test", &Database::test,
-             "Test the condition string tokenizer")
         .def_static("get_char_info", &Database::get_char_info,
                     "Get Hanzi information by character index",
                     py::arg("index"))
@@ -0,0 +1,109 @@
+#include "query.h"
+
+std::string LineWindow::toString() const {
+    std::string result;
+    for(size_t i = 0; i < lines.size(); ++i){
+        if(i > 0)
+            result += " / ";
+        result += lines[i]->toString();
+    }
+    return result;
+}
+
+LineWindow parseLineWindow(const std::vector<cond_token>& tokens, size_t pos, size_t pos_end){
+    LineWindow window;
+    size_t begin = pos;
+    for(size_t i = pos; i <= pos_end; i = i < pos_end ? tokens[i].nxt_pos : i + 1){
+        if(i < pos_end && tokens[i].type != cond_token::TokenType::Slash)
+            continue;
+        if(begin == i){
+            auto at = i < pos_end ? tokens[i].original_pos : i > 0 ? tokens[i - 1].original_pos : std::make_pair<size_t, size_t>(0, 0);
+            throw ParseException("missing line condition in window", at.first, at.second);
+        }
+        size_t cur = begin;
+        auto line = parseGlobalExpression(tokens, cur, i);
+        if(!line)
+            throw ParseException("missing line condition in window", begin, i);
+        window.lines.push_back(line);
+        begin = i + 1;
+    }
+    return window;
+}
+
+LineWindow parseWindowQuery(const std::string& queryStr){
+    auto tokens = tokenizeCondString(queryStr);
+    return parseLineWindow(tokens, 0, tokens.size());
+}
+
+std::string PoemClause::toString() const {
+    switch(quantifier){
+        case Any: return "any: " + window.toString();
+        case All: return "all: " + window.toString();
+        case AtLeast: return "count>=" + std::to_string(count) + ": " + window.toString();
+        case AtMost: return "count<=" + std::to_string(count) + ": " + window.toString();
+        case Exactly: return "count=" + std::to_string(count) + ": " + window.toString();
+        case Rhyme: return "rhyme";
+    }
+    return window.toString();
+}
+
+std::string PoemQuery::toString() const {
+    std::string result;
+    for(size_t i = 0; i < clauses.size(); ++i){
+        if(i > 0)
+            result += " ; ";
+        result += clauses[i].toString();
+    }
+    return result;
+}
+
+PoemClause parsePoemClause(const std::vector<cond_token>& tokens, size_t pos, size_t pos_end){
+    PoemClause clause;
+    auto is = [&](size_t i, cond_token::TokenType type){
+        return i < pos_end && tokens[i].type == type;
+    };
+
+    if(is(pos, cond_token::TokenType::Letters)){
+        auto& name = tokens[pos].value;
+        if(name == "rhyme" && pos + 1 == pos_end){
+            clause.quantifier = PoemClause::Rhyme;
+            clause.quantified = true;
+            return clause;
+        }else if((name == "any" || name == "all") && is(pos + 1, cond_token::TokenType::Colon)){
+            clause.quantifier = name == "any" ? PoemClause::Any : PoemClause::All;
+            clause.quantified = true;
+            pos += 2;
+        }else if(name == "count"){
+            auto& op = tokens[pos + 1 < pos_end ? pos + 1 : pos];
+            if(is(pos + 1, cond_token::TokenType::Ge))
+                clause.quantifier = PoemClause::AtLeast;
+            else if(is(pos + 1, cond_token::TokenType::Le))
+                clause.quantifier = PoemClause::AtMost;
+            else if(is(pos + 1, cond_token::TokenType::Eq))
+                clause.quantifier = PoemClause::Exactly;
+            else
+                throw ParseException("expected '>=', '<=' or '=' after count", op.original_pos.first, op.original_pos.second);
+            if(!is(pos + 2, cond_token::TokenType::Number) || !is(pos + 3, cond_token::TokenType::Colon))
+                throw ParseException("expected count and ':'", op.original_pos.first, op.original_pos.second);
+            clause.count = std::stoul(tokens[pos + 2].value);
+            clause.quantified = true;
+            pos += 4;
+        }
+    }
+
+    clause.window = parseLineWindow(tokens, pos, pos_end);
+    return clause;
+}
+
+PoemQuery parsePoemQuery(const std::string& queryStr){
+    auto tokens = tokenizeCondString(queryStr);
+    PoemQuery query;
+    size_t begin = 0;
+    for(size_t i = 0; i <= tokens.size(); i = i < tokens.size() ? tokens[i].nxt_pos : i + 1){
+        if(i < tokens.size() && tokens[i].type != cond_token::TokenType::Semicolon)
+            continue;
+        query.clauses.push_back(parsePoemClause(tokens, begin, i));
+        begin = i + 1;
+    }
+    return query;
+}
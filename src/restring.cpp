@@ -1,5 +1,6 @@
 
 #include "restring.h"
+#include <algorithm>
 
 std::unordered_map<uint32_t, int16_t> ReString::char_map;
 std::unordered_map<uint16_t, uint32_t> ReString::code_map;
@@ -131,10 +132,15 @@ size_t ReString::estimateMapMemoryUse() {
     total += code_map.bucket_count() * sizeof(void*);
     total += (sizeof(uint32_t) + sizeof(int16_t)) * char_map.size();
     total += (sizeof(uint16_t) + sizeof(uint32_t)) * code_map.size();
+    total += code_frequency.capacity() * sizeof(uint32_t);
+    total += rhyme_group.capacity() * sizeof(uint16_t);
     return total;
 }
 
 std::unordered_map<uint16_t, HanziData> ReString::hanzi_data;
+std::vector<uint32_t> ReString::code_frequency;
+std::vector<uint16_t> ReString::rhyme_group;
+std::vector<std::string> ReString::rhyme_finals;
 
 bool ReString::loadHanziData(const std::string& filename) {
     auto res = readHanziData(filename);
@@ -159,8 +165,35 @@ bool ReString::loadHanziData(const std::string& filename) {
             hd.chaizi.push_back(ReString(cz));
         }
         hd.pinyin = hanzi.pinyin;
+        for(size_t i = 0; i < hd.pinyin.size(); ++i) {
+            auto& py = hd.pinyin[i];
+            uint8_t tone = !py.empty() && py.back() >= '1' && py.back() <= '4' ? py.back() - '0' : 0;
+            hd.tones |= 1 << tone;
+            if(i == 0) {
+                hd.first_tone = tone;
+            }
+        }
         hanzi_data[idx] = hd;
     }
+
+    rhyme_finals.assign(1, "");
+    rhyme_group.assign(char_map.size(), 0);
+    std::unordered_map<std::string, uint16_t> final_ids;
+    for (auto& [code, hd] : hanzi_data) {
+        if (hd.pinyin.empty() || hd.first_tone == 0) {
+            continue;
+        }
+        auto final = pinyinFinal(hd.pinyin[0]);
+        if (final.empty()) {
+            continue;
+        }
+        auto it = final_ids.find(final);
+        if (it == final_ids.end()) {
+            it = final_ids.emplace(final, (uint16_t)rhyme_finals.size()).first;
+            rhyme_finals.push_back(final);
+        }
+        rhyme_group[code] = (uint16_t)(it->second << 1 | (hd.first_tone >= 3 ? 1 : 0));
+    }
     return true;
 }
 
@@ -173,4 +206,59 @@ HanziData& ReString::getHanziData(uint16_t code){
         hanzi_data[code] = data;
         return hanzi_data.at(code);
     }
-}
\ No newline at end of file
+}
+std::string ReString::pinyinFinal(const std::string& pinyin) {
+    std::string s;
+    for (size_t i = 0; i < pinyin.size(); ++i) {
+        unsigned char c = pinyin[i];
+        if (c == 0xC9 && i + 1 < pinyin.size() && (unsigned char)pinyin[i + 1] == 0xA1) {
+            s += 'g', ++i;  // U+0261 LATIN SMALL LETTER SCRIPT G
+        } else if (c == 0xC3 && i + 1 < pinyin.size() && (unsigned char)pinyin[i + 1] == 0xBC) {
+            s += 'v', ++i;  // U+00FC LATIN SMALL LETTER U WITH DIAERESIS
+        } else if (isalpha(c)) {
+            s += (char)tolower(c);
+        }
+    }
+
+    std::string initial;
+    if (s.size() >= 2 && (s.compare(0, 2, "zh") == 0 || s.compare(0, 2, "ch") == 0 || s.compare(0, 2, "sh") == 0)) {
+        initial = s.substr(0, 2);
+    } else if (!s.empty() && std::string("bpmfdtnlgkhjqxrzcsyw").find(s[0]) != std::string::npos) {
+        initial = s.substr(0, 1);
+    }
+    // A bare nasal such as "m" or "ng" has no final.
+    if (initial.size() == s.size()) {
+        return "";
+    }
+    auto final = s.substr(initial.size());
+
+    if (initial == "y") {
+        final = final[0] == 'u' ? "v" + final.substr(1) : final[0] == 'i' ? final : "i" + final;
+    } else if (initial == "w") {
+        final = final[0] == 'u' ? final : "u" + final;
+    } else if ((initial == "j" || initial == "q" || initial == "x") && final[0] == 'u') {
+        final[0] = 'v';
+    }
+
+    if (final.size() >= 2 && (final[0] == 'i' || final[0] == 'u' || final[0] == 'v') &&
+        (final[1] == 'a' || final[1] == 'e' || final[1] == 'o')) {
+        final = final.substr(1);
+    }
+    if (final == "iu") {
+        final = "ou";
+    } else if (final == "ui") {
+        final = "ei";
+    } else if (final == "un" || final == "vn") {
+        final = "en";
+    }
+    return final;
+}
+
+int ReString::getRhymeFinal(const std::string& final) {
+    auto it = std::find(rhyme_finals.begin() + (rhyme_finals.empty() ? 0 : 1), rhyme_finals.end(), final);
+    return it == rhyme_finals.end() ? -1 : (int)(it - rhyme_finals.begin());
+}
+
+uint16_t ReString::getRhymeGroup(uint16_t code) {
+    return code < rhyme_group.size() ? rhyme_group[code] : 0;
+}
@@ -0,0 +1,222 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace {
+
+thread_local ThreadPool* current = nullptr;
+
+// CPUs the process is allowed to run on, empty where affinity is not
+// supported.
+std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+#elif defined(_WIN32)
+    DWORD_PTR process_mask, system_mask;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+        for (int cpu = 0; cpu < static_cast<int>(sizeof(DWORD_PTR) * 8); ++cpu) {
+            if (process_mask & (static_cast<DWORD_PTR>(1) << cpu)) cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
+bool pinThread(std::thread& thread, int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    return SetThreadAffinityMask(static_cast<HANDLE>(thread.native_handle()), static_cast<DWORD_PTR>(1) << cpu) != 0;
+#else
+    (void)thread;
+    (void)cpu;
+    return false;
+#endif
+}
+
+}
+
+ThreadPool::ThreadPool(size_t threads, bool pin) {
+    resize(threads, pin);
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+void ThreadPool::resize(size_t threads, bool pin) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        checkResizing();
+        if (busy_ > 0) {
+            throw std::runtime_error("cannot resize the thread pool while work is queued or running on it");
+        }
+        resizing_ = true;
+    }
+    // Nothing else reads workers_ until resizing_ is cleared.
+    try {
+        stop();
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        auto cpus = pin ? allowedCpus() : std::vector<int>();
+        pinned_ = !cpus.empty();
+        for (size_t i = 1; i < threads; ++i) {
+            workers_.emplace_back([this] { work(); });
+            if (pinned_) {
+                pinned_ = pinThread(workers_.back(), cpus[i % cpus.size()]);
+            }
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_ = workers_.size() + 1;
+        resizing_ = false;
+        throw;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_ = workers_.size() + 1;
+    resizing_ = false;
+}
+
+void ThreadPool::checkResizing() const {
+    if (resizing_) {
+        throw std::runtime_error("the thread pool is being resized");
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_ = 1;
+    stopping_ = false;
+}
+
+void ThreadPool::work() {
+    current = this;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this] { return stopping_ || !jobs_.empty() || !tasks_.empty(); });
+        if (!jobs_.empty()) {
+            auto job = jobs_.front();
+            size_t slot = job->next_slot++;
+            if (job->next_slot == job->slots) {
+                jobs_.pop_front();
+            }
+            job->running++;
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                (*job->body)(slot);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            if (error && !job->error) {
+                job->error = error;
+            }
+            if (--job->running == 0) {
+                done_.notify_all();
+            }
+        } else if (!tasks_.empty()) {
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+            task.body();
+            lock.lock();
+            --busy_;
+            if (task.then) {
+                lock.unlock();
+                task.then();
+                lock.lock();
+            }
+        } else {
+            return;
+        }
+    }
+}
+
+void ThreadPool::run(const std::function<void(size_t)>& body) {
+    auto job = std::make_shared<Job>();
+    job->body = &body;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        checkResizing();
+        job->slots = workers_.size() + 1;
+        if (job->slots > 1) {
+            jobs_.push_back(job);
+            ++busy_;
+        }
+    }
+    if (job->slots == 1) {
+        body(0);
+        return;
+    }
+    wake_.notify_all();
+
+    std::exception_ptr error;
+    try {
+        body(0);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = std::find(jobs_.begin(), jobs_.end(), job);
+    if (it != jobs_.end()) {
+        jobs_.erase(it);
+    }
+    done_.wait(lock, [&] { return job->running == 0; });
+    --busy_;
+    if (!error) {
+        error = job->error;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+ThreadPool* ThreadPool::active() {
+    return current;
+}
+
+ThreadPool::Scope::Scope(ThreadPool* pool) : pool_(pool), saved_(current) {
+    if (pool_) {
+        std::lock_guard<std::mutex> lock(pool_->mutex_);
+        pool_->checkResizing();
+        ++pool_->busy_;
+    }
+    current = pool;
+}
+
+ThreadPool::Scope::~Scope() {
+    current = saved_;
+    if (pool_) {
+        std::lock_guard<std::mutex> lock(pool_->mutex_);
+        --pool_->busy_;
+    }
+}
@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "database.h"
+#include "executor.h"
+#include "query.h"
+
+namespace {
+
+int failures = 0;
+
+std::vector<size_t> matchPoems(const PoetryDatabase& db, const std::string& queryStr) {
+    auto query = parsePoemQuery(queryStr);
+    std::vector<std::vector<MatchProgram>> programs;
+    for (auto& clause : query.clauses) {
+        programs.emplace_back();
+        for (auto& line : clause.window.lines) {
+            programs.back().push_back(MatchProgram::lower(line->compile()));
+        }
+    }
+    PoemExecutor executor;
+    std::vector<size_t> ids;
+    for (auto& result : executor.execute(query, programs, db.getAllPoetry(), db.getSentenceStore())) {
+        ids.push_back(result.poetry_id);
+    }
+    return ids;
+}
+
+void expect(const PoetryDatabase& db, const std::string& query, const std::vector<size_t>& expected) {
+    auto actual = matchPoems(db, query);
+    if (actual != expected) {
+        std::cerr << query << ": expected";
+        for (auto id : expected) std::cerr << " " << id;
+        std::cerr << ", got";
+        for (auto id : actual) std::cerr << " " << id;
+        std::cerr << std::endl;
+        ++failures;
+    }
+}
+
+}
+
+int main() {
+    const char* path = "poem_test.csv";
+    FILE* file = std::fopen(path, "w");
+    if (!file) {
+        std::cerr << "cannot write " << path << std::endl;
+        return 1;
+    }
+    std::fputs("题目,朝代,作者,内容\n"
+               "甲,唐,某,山水清，日月明。\n"
+               "乙,唐,某,青山在，绿水流。\n"
+               "丙,唐,某,山中客，山中人。\n", file);
+    std::fclose(file);
+
+    PoetryDatabase db;
+    db.loadFromCSV(path);
+    std::remove(path);
+    // Conditions only see characters with hanzi data, which load_hanzi_info
+    // would read from the JSON file.
+    for (auto& [cp, code] : ReString::char_map) {
+        HanziData data{};
+        data.index = code;
+        ReString::hanzi_data[code] = data;
+    }
+
+    // Each any: clause needs a line of its own.
+    expect(db, "any: #*山#* ; any: #*水#*", {1});
+    expect(db, "any: #*山#* ; any: #*山#*", {2});
+    expect(db, "#*山#* ; #*水#*", {1});
+    // Other quantifiers may share the line an any: clause matched.
+    expect(db, "count>=1: #*山#* ; any: #*水#*", {0, 1});
+    expect(db, "any: #*山#* ; all: ###", {0, 1, 2});
+
+    if (failures) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}
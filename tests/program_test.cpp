@@ -0,0 +1,96 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cond_parser.h"
+#include "program.h"
+
+namespace {
+
+int failures = 0;
+
+bool matches(const std::string& pattern, const std::string& sentence) {
+    auto program = MatchProgram::lower(parseCond(pattern)->compile());
+    return program.match(ReString(sentence, false));
+}
+
+void expect(const std::string& pattern, const std::string& sentence, bool expected) {
+    bool actual;
+    try {
+        actual = matches(pattern, sentence);
+    } catch (const std::exception& e) {
+        std::cerr << pattern << " on " << sentence << " threw: " << e.what() << std::endl;
+        ++failures;
+        return;
+    }
+    if (actual != expected) {
+        std::cerr << pattern << " on " << sentence << ": expected " << expected << ", got " << actual << std::endl;
+        ++failures;
+    }
+}
+
+// Patterns written in different ways must agree on every sample.
+void expectEquivalent(const std::string& a, const std::string& b, const std::vector<std::string>& samples) {
+    for (auto& sample : samples) {
+        expect(a, sample, matches(b, sample));
+    }
+}
+
+}
+
+int main() {
+    const std::vector<std::string> samples = {
+        "月", "明月", "明光月", "光光月", "明日月", "明光日月", "月明光",
+        "明月光月", "明月光日", "明月光月日", "明月光日月", "明光日",
+        "明光山水日", "月光日", "明光月光日", "明光山水明光日",
+        "光明明光月", "明明月", "明山水月", "明水山月",
+    };
+    // Conditions only see characters with hanzi data, which load_hanzi_info
+    // would read from the JSON file.
+    for (auto& sample : samples) {
+        for (auto code : ReString(sample, true)) {
+            HanziData data{};
+            data.index = code;
+            ReString::hanzi_data[code] = data;
+        }
+    }
+
+    // Repeats the DFA handles, run only over their fixed window.
+    expect("#{2}月", "明光月", true);
+    expect("#{2}月", "明光日月", false);
+    expect("#{2}月", "月明光", false);
+    expectEquivalent("#{2}月", "##月", samples);
+    expect("(明|光){2}月", "光光月", true);
+    expect("(明|光){2}月", "明日月", false);
+    expectEquivalent("(明|光){2}月", "[明光][明光]月", samples);
+
+    // Repeats over &, ! and <...> subterms go through the position automaton.
+    expect("(##&#月){2}#", "明月光月日", true);
+    expect("(##&#月){2}#", "明月光日月", false);
+    expect("(##&#月){2}#", "明月光月", false);
+    expectEquivalent("(##&#月){2}#", "(##&#月)(##&#月)#", samples);
+    expect("(##&#月){2}", "明月光月", true);
+    expect("(##&#月){2}", "明月光日", false);
+    expectEquivalent("(##&#月){2}", "(##&#月)(##&#月)", samples);
+
+    expect("(<明光>)*月", "月", true);
+    expect("(<明光>)*月", "明光月", true);
+    expect("(<明光>)*月", "光明明光月", true);
+    expect("(<明光>)*月", "明明月", false);
+
+    expect("(##&!(月#)){1,2}日", "明光日", true);
+    expect("(##&!(月#)){1,2}日", "明光山水日", true);
+    expect("(##&!(月#)){1,2}日", "月光日", false);
+    expect("(##&!(月#)){1,2}日", "明光月光日", false);
+    expect("(##&!(月#)){1,2}日", "明光山水明光日", false);
+
+    expect("#*(<山水>&#水)#*", "明山水月", true);
+    expect("#*(<山水>&#水)#*", "明水山月", false);
+
+    if (failures) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}